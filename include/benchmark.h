@@ -0,0 +1,104 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <cstdio>
+
+namespace rtt
+{
+	// one measurement of the benchmark suite, ns/op and ms are better lower, rays/s higher
+	class BenchmarkResult {
+		public:
+			std::string name;
+			std::string unit;
+			double value;
+
+			BenchmarkResult(const std::string &name, const std::string &unit, double value) : name(name), unit(unit), value(value) {}
+
+			bool higherIsBetter() const { return unit == "rays/s"; }
+	};
+
+	// keeps the results of the timed operations alive, so that the compiler cannot drop them
+	volatile float benchmarkSink = 0.f;
+
+	// nanoseconds per call of operation(i) for i in [0, count), the best of repeats runs against the noise of the machine
+	template<class Operation>
+	double timeOperation(unsigned int count, Operation &&operation, unsigned int repeats = 5) {
+		double best = std::numeric_limits<double>::max();
+		for (unsigned int r = 0; r < repeats; r++) {
+			auto t1 = std::chrono::high_resolution_clock::now();
+			for (unsigned int i = 0; i < count; i++) operation(i);
+			auto t2 = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::nano>(t2 - t1).count() / count);
+		}
+		return best;
+	}
+
+	void printBenchmarkResult(const BenchmarkResult &result) {
+		std::cout << result.name << ": " << result.value << " " << result.unit << std::endl;
+	}
+
+	bool writeBenchmarkResults(const std::string &path, const std::vector<BenchmarkResult> &results) {
+		std::ofstream file(path);
+		if (!file) {
+			std::cout << "cannot write " << path << std::endl;
+			return false;
+		}
+		file.precision(9);
+		file << "{\n\t\"results\": [\n";
+		for (unsigned int i = 0; i < results.size(); i++)
+			file << "\t\t{\"name\": \"" << results[i].name << "\", \"unit\": \"" << results[i].unit << "\", \"value\": " << results[i].value << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+		file << "\t]\n}\n";
+		return true;
+	}
+
+	// reads the files written by writeBenchmarkResults, one result per line
+	bool readBenchmarkResults(const std::string &path, std::vector<BenchmarkResult> &results) {
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "cannot read " << path << std::endl;
+			return false;
+		}
+		const auto field = [](const std::string &line, const std::string &key) {
+			const size_t begin = line.find("\"" + key + "\": ");
+			if (begin == std::string::npos) return std::string();
+			size_t first = begin + key.size() + 4;
+			if (line[first] == '"') return line.substr(first + 1, line.find('"', first + 1) - first - 1);
+			return line.substr(first, line.find_first_of(",}", first) - first);
+		};
+		std::string line;
+		while (std::getline(file, line)) {
+			const std::string name = field(line, "name");
+			const std::string value = field(line, "value");
+			if (name.empty() || value.empty()) continue;
+			results.emplace_back(name, field(line, "unit"), std::stod(value));
+		}
+		return true;
+	}
+
+	// prints the change of every result found in the baseline, returns the number of results worse by more than tolerance
+	unsigned int compareBenchmarkResults(const std::vector<BenchmarkResult> &baseline, const std::vector<BenchmarkResult> &results, double tolerance) {
+		unsigned int regressions = 0;
+		for (const auto &result : results) {
+			const auto base = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkResult &b) { return b.name == result.name && b.unit == result.unit; });
+			if (base == baseline.end() || base->value <= 0.0) {
+				std::cout << result.name << ": not in the baseline" << std::endl;
+				continue;
+			}
+			// > 1 is an improvement whatever the unit
+			const double speedup = result.higherIsBetter() ? result.value / base->value : base->value / result.value;
+			const bool regression = speedup < 1.0 - tolerance;
+			regressions += regression;
+			char change[32];
+			std::snprintf(change, sizeof(change), "%+.1f%%", (speedup - 1.0) * 100.0);
+			std::cout << result.name << ": " << base->value << " -> " << result.value << " " << result.unit << " (" << change << ")" << (regression ? "  REGRESSION" : "") << std::endl;
+		}
+		std::cout << regressions << " regression(s) beyond " << tolerance * 100.0 << "%" << std::endl;
+		return regressions;
+	}
+}
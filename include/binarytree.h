@@ -92,17 +92,20 @@ class SNode {
 			}
 		}
 
+		// called by every render thread at once: the counts and fluxes are atomic and the trees keep their topology
+		// until the end of the iteration
 		void recordPosition(glm::vec3 point, glm::vec3 wo, std::vector<std::vector<glm::vec3>> &image, int side, glm::vec2 p, glm::vec3 radiance) {
 			if (b.containsPoint(point)) {
-				sampleCount.store(sampleCount.load() + 1.f);
+				atomicAdd(sampleCount, 1.f);
 				if (!isLeaf()) {
 					children[0].recordPosition(point, wo, image, side, p, radiance);
 					children[1].recordPosition(point, wo, image, side, p, radiance);
 				} else {
 					// you are in the leaf of the intersection position --> update the corresponding quadtree
+					// debug image only, written without synchronization: concurrent splats on one pixel race, and the pixel
+					// may end up mixing their components
 					image[p.x * side][p.y * side] = radiance;
 					quad.splatDirection(p, radiance);
-					quad.refineQuadTree();
 				}
 			}
 		}
@@ -124,9 +127,8 @@ class SNode {
 		void resetQuadTree(int side, int i, int quadNumber) {
 			if(isLeaf()) {
 				quad.saveQuadtreeImage(side, i, quadNumber);
-				QuadTree pq = quad; // !!! Make a deep copy (do not allow shared memory)	
-				previousQuad =(pq);
-				quad.reset();
+				previousQuad = quad; // copy of the node array, the sampling tree of the next iteration
+				quad.prepareNextIteration();
 			} else {
 				children[0].resetQuadTree(side, i, 2 * quadNumber+1);
 				children[1].resetQuadTree(side, i, 2 * quadNumber+2);
@@ -142,7 +144,7 @@ class BinaryTree {
 		BinaryTree(glm::vec3 min_, glm::vec3 max_, int gui_c, float gui_t) : root(SNode(0, BBox3D(min_, max_), QuadTree(gui_t), QuadTree())) {c = gui_c;}
 
 		void splatPosition (glm::vec3 point, glm::vec3 wo, std::vector<std::vector<glm::vec3>> &image, int side, glm::vec2 p, glm::vec3 radiance) {
-			sampleCount.store(sampleCount.load() + 1.f);
+			atomicAdd(sampleCount, 1.f);
 			root.recordPosition(point, wo, image, side, p, radiance);
 		}
 
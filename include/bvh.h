@@ -6,6 +6,9 @@
 #include "bounding_volume.h"
 #include "triangle.h"
 #include "mesh.h"
+#include "threadpool.h"
+#include "instrument.h"
+#include "trace.h"
 
 #include "parser.h"
 
@@ -33,6 +36,8 @@ namespace rtt
 	{
 	public:
 		glm::vec3 min_, max_;
+		unsigned long triangleCount = 0;
+		std::vector<MaterialDescription> materials; // of the scene file, indexed by Intersection::material
 		virtual bool intersect(Intersection &its, const Ray &ray) const = 0;
 		virtual ~BVH() = default;
 	};
@@ -51,6 +56,7 @@ namespace rtt
 			: vertices(std::move(vertices))
 		{
 			std::cout << "number of triangles: " << triangles.triangles.size() << "\n";
+			triangleCount = triangles.triangles.size();
 			
 			number_of_leaves = findNextPowerOfTwo(triangles.triangles.size());
 			volumes = std::vector<BoundingVolume>(number_of_leaves*2);
@@ -73,6 +79,7 @@ namespace rtt
 			float temp;
 			const Ray inv_ray(ray.origin, 1.f / ray.direction);
 			const Ray inv_ray45(glm::rotate(ray.origin, glm::radians(45.f), glm::vec3(1, 1, 1)), 1.f / glm::rotate(ray.direction, glm::radians(45.f), glm::vec3(1, 1, 1)));
+			RTT_COUNT(boxes, 1);
 			if (volumes[0].intersect_box(inv_ray, inv_ray45, temp)) 
 				return intersect_recursively(its, ray, inv_ray, inv_ray45, 0);
 			return false;
@@ -114,14 +121,25 @@ namespace rtt
 			{
 				std::vector<std::pair<glm::vec3, unsigned long>> p1(grav_centers.begin(), grav_centers.begin() + grav_centers.size()/2);
 				std::vector<std::pair<glm::vec3, unsigned long>> p2(grav_centers.begin() + grav_centers.size()/2, grav_centers.end());
-				recursively_split(p1, triangles, index*2+1);
-				recursively_split(p2, triangles, index*2+2);
+				if (index < 2 * threadPool().size()) // the subtrees write disjoint nodes, build the top levels in parallel
+				{
+					threadPool().parallelFor(2, [&](unsigned int i, unsigned int) {
+						RTT_TRACE_SCOPE("bvh subtree", index*2+1 + i);
+						recursively_split(i == 0 ? p1 : p2, triangles, index*2+1 + i);
+					});
+				}
+				else
+				{
+					recursively_split(p1, triangles, index*2+1);
+					recursively_split(p2, triangles, index*2+2);
+				}
 			}
 			volumes[index] = BoundingVolume(volumes[index*2+1], volumes[index*2+2]);
 		}
 
 		bool intersect_recursively(Intersection &its, const Ray &ray, const Ray &inv_ray, const Ray& inv_ray45, unsigned int index) const
 		{
+			RTT_COUNT(nodes, 1);
 			if (index >= number_of_leaves-1)
 			{
 				triangles_values[index - (number_of_leaves-1)].intersect(ray, its);
@@ -130,6 +148,7 @@ namespace rtt
 
 			bool box[2];
 			float temp[2]; 
+			RTT_COUNT(boxes, 2);
 			box[0] = volumes[index*2+1].intersect_box(inv_ray, inv_ray45, temp[0]);
 			box[1] = volumes[index*2+2].intersect_box(inv_ray, inv_ray45, temp[1]);
 			temp[0] = box[0] ? temp[0] : std::numeric_limits<float>::max();
@@ -153,9 +172,9 @@ namespace rtt
 	};
 
 	template<class IndexSize>
-	const std::unique_ptr<BVH> create_template_BVH(vector<vec3> &vertices, vector<vec2> &uvs, vector< vec3> &normals,
+	std::unique_ptr<BVH> create_template_BVH(vector<vec3> &vertices, vector<vec2> &uvs, vector< vec3> &normals,
 		vector<unsigned long> &vertex_indices, vector<unsigned long> &uv_indices, vector<unsigned long> &normal_indices, 
-		vector<vec3> &ordered_vertices)
+		vector<vec3> &ordered_vertices, const vector<unsigned short> &material_indices)
 	{
 			vector<IndexSize> new_vertex_indices;
 			vector<IndexSize> new_uv_indices;
@@ -173,7 +192,7 @@ namespace rtt
 				new_normal_indices.push_back(normal_indices[i]);
 
 			return std::make_unique<BVH_template<IndexSize>>(rtt::MeshValues(vertices, normals, uvs)
-				, rtt::MeshIndices<IndexSize>(new_vertex_indices, new_normal_indices, new_uv_indices)
+				, rtt::MeshIndices<IndexSize>(new_vertex_indices, new_normal_indices, new_uv_indices, material_indices)
 				, ordered_vertices);
 	}
 
@@ -186,15 +205,26 @@ namespace rtt
 		vector<unsigned long> uv_indices;
 		vector<unsigned long> normal_indices;
 		vector<vec3> ordered_vertices;
+		vector<MaterialDescription> materials;
+		vector<unsigned short> material_indices;
 
-		parseFile(dir_path, scene_name, out_vertices, out_uvs, out_normals, vertex_indices, uv_indices, normal_indices, ordered_vertices);
+		{
+			RTT_TRACE_SCOPE("parse scene");
+			parseFile(dir_path, scene_name, out_vertices, out_uvs, out_normals, vertex_indices, uv_indices, normal_indices, ordered_vertices, materials, material_indices);
+		}
+		std::cout << "number of materials: " << materials.size() << "\n";
 
+		RTT_TRACE_SCOPE("bvh build");
+		std::unique_ptr<BVH> bvh;
 		if (out_vertices.size() <= std::numeric_limits<unsigned short>::max())
-			return create_template_BVH<unsigned short>(out_vertices, out_uvs, out_normals, vertex_indices, uv_indices, normal_indices, ordered_vertices);
-		if (out_vertices.size() <= std::numeric_limits<unsigned int>::max())
-			return create_template_BVH<unsigned int>(out_vertices, out_uvs, out_normals, vertex_indices, uv_indices, normal_indices, ordered_vertices);
-		return std::make_unique<BVH_template<unsigned long>>(rtt::MeshValues(out_vertices, out_normals, out_uvs)
-			, rtt::MeshIndices<unsigned long>(vertex_indices, normal_indices, uv_indices)
-			, ordered_vertices);
+			bvh = create_template_BVH<unsigned short>(out_vertices, out_uvs, out_normals, vertex_indices, uv_indices, normal_indices, ordered_vertices, material_indices);
+		else if (out_vertices.size() <= std::numeric_limits<unsigned int>::max())
+			bvh = create_template_BVH<unsigned int>(out_vertices, out_uvs, out_normals, vertex_indices, uv_indices, normal_indices, ordered_vertices, material_indices);
+		else
+			bvh = std::make_unique<BVH_template<unsigned long>>(rtt::MeshValues(out_vertices, out_normals, out_uvs)
+				, rtt::MeshIndices<unsigned long>(vertex_indices, normal_indices, uv_indices, material_indices)
+				, ordered_vertices);
+		bvh->materials = std::move(materials);
+		return bvh;
 	}
 }
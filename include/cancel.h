@@ -0,0 +1,22 @@
+#pragma once
+
+#include <atomic>
+
+namespace rtt
+{
+	// Raised by the GUI thread when the parameters change. Tiles and pixel loops poll it with a relaxed load,
+	// so an outdated frame is abandoned within one pixel of work.
+	class CancelToken {
+		private:
+			std::atomic<bool> cancelled{false};
+
+		public:
+			CancelToken() = default;
+			CancelToken(const CancelToken &) {} // copies start uncancelled
+			CancelToken& operator=(const CancelToken &) { reset(); return *this; }
+
+			void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+			void reset() { cancelled.store(false, std::memory_order_relaxed); }
+			bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+	};
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "film.h"
+#include "threadpool.h"
+#include "trace.h"
+
+namespace rtt
+{
+	// Edge-avoiding a-trous wavelet filter ("Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination Filtering",
+	// Dammertz et al. 2010) guided by the first-hit normal, albedo and depth accumulated in the film.
+	// The illumination (colour / albedo) is filtered so that texture detail survives. The planes are stored as structure
+	// of arrays and every kernel tap runs a branch-free loop over a row, which the compiler can vectorize.
+	class Denoiser {
+		public:
+			int iterations; // the kernel footprint doubles every iteration
+			float sigmaColor; // halved every iteration
+			float sigmaNormal;
+			float sigmaAlbedo;
+			float sigmaDepth; // relative to the depth of the filtered pixel
+
+			Denoiser() : iterations(5), sigmaColor(0.5f), sigmaNormal(0.3f), sigmaAlbedo(0.1f), sigmaDepth(0.1f) {}
+
+			void denoise(const Film &film, std::vector<glm::vec3> &image) {
+				RTT_TRACE_SCOPE("denoise");
+				width = film.width;
+				height = film.height;
+				load(film);
+
+				for (int i = 0; i < iterations; i++) {
+					const float sigma = sigmaColor / (float) (1 << i);
+					filter(1 << i, 1.f / (sigma * sigma));
+					std::swap(color, filtered);
+				}
+
+				threadPool().parallelForRange(width * height, 4096, [&](unsigned int begin, unsigned int end, unsigned int) {
+					for (unsigned int p = begin; p < end; p++)
+						image[p] = glm::vec3(color[0][p], color[1][p], color[2][p]) * (glm::vec3(albedo[0][p], albedo[1][p], albedo[2][p]) + epsilon);
+				});
+			}
+
+		private:
+			static constexpr float epsilon = 1e-3f;
+			unsigned int width = 0;
+			unsigned int height = 0;
+			std::vector<float> color[3]; // illumination
+			std::vector<float> filtered[3];
+			std::vector<float> normal[3];
+			std::vector<float> albedo[3];
+			std::vector<float> depth;
+			std::vector<std::vector<float>> scratch; // per pool thread row sums (3 colour planes and the weights), reused across frames
+
+			void load(const Film &film) {
+				const unsigned int pixels = width * height;
+				for (int c = 0; c < 3; c++) {
+					color[c].resize(pixels);
+					filtered[c].resize(pixels);
+					normal[c].resize(pixels);
+					albedo[c].resize(pixels);
+				}
+				depth.resize(pixels);
+
+				threadPool().parallelForRange(pixels, 4096, [&](unsigned int begin, unsigned int end, unsigned int) {
+					for (unsigned int p = begin; p < end; p++) {
+						const float inv = film.pixelSamples[p] > 0 ? 1.f / film.pixelSamples[p] : 0.f;
+						const glm::vec3 a = film.albedos[p] * inv;
+						const glm::vec3 c = film.accumulated[p] * inv / (a + epsilon);
+						const glm::vec3 n = film.normals[p] * inv;
+						for (int k = 0; k < 3; k++) {
+							color[k][p] = c[k];
+							normal[k][p] = n[k];
+							albedo[k][p] = a[k];
+						}
+						depth[p] = film.depths[p] * inv;
+					}
+				});
+			}
+
+			void filter(int step, float invSigmaColor2) {
+				const float kernel[5] = {1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f}; // B3 spline
+				const float invSigmaNormal2 = 1.f / (sigmaNormal * sigmaNormal);
+				const float invSigmaAlbedo2 = 1.f / (sigmaAlbedo * sigmaAlbedo);
+				const int w = width;
+				const int h = height;
+
+				scratch.resize(threadPool().size());
+				for (auto &rows : scratch) rows.resize(4 * w);
+
+				threadPool().parallelForRange(h, 4, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+					float *sum[3] = {scratch[thread].data(), scratch[thread].data() + w, scratch[thread].data() + 2 * w};
+					float *weights = scratch[thread].data() + 3 * w;
+
+					for (int y = begin; y < (int) end; y++) {
+						std::fill(scratch[thread].begin(), scratch[thread].end(), 0.f);
+
+						for (int ky = -2; ky <= 2; ky++) {
+							const int yq = y + ky * step;
+							if (yq < 0 || yq >= h) continue;
+							for (int kx = -2; kx <= 2; kx++) {
+								const int dx = kx * step;
+								const float hk = kernel[ky + 2] * kernel[kx + 2];
+								const int xBegin = std::max(0, -dx);
+								const int xEnd = std::min(w, w - dx);
+								const int rowP = y * w;
+								const int rowQ = yq * w + dx;
+
+								#pragma omp simd
+								for (int x = xBegin; x < xEnd; x++) {
+									const int p = rowP + x;
+									const int q = rowQ + x;
+									const float dr = color[0][p] - color[0][q], dg = color[1][p] - color[1][q], db = color[2][p] - color[2][q];
+									const float nx = normal[0][p] - normal[0][q], ny = normal[1][p] - normal[1][q], nz = normal[2][p] - normal[2][q];
+									const float ar = albedo[0][p] - albedo[0][q], ag = albedo[1][p] - albedo[1][q], ab = albedo[2][p] - albedo[2][q];
+									const float dd = std::abs(depth[p] - depth[q]) / (sigmaDepth * depth[p] + epsilon);
+									const float weight = hk * std::exp(-(dr * dr + dg * dg + db * db) * invSigmaColor2
+										- (nx * nx + ny * ny + nz * nz) * invSigmaNormal2
+										- (ar * ar + ag * ag + ab * ab) * invSigmaAlbedo2
+										- dd);
+									sum[0][x] += weight * color[0][q];
+									sum[1][x] += weight * color[1][q];
+									sum[2][x] += weight * color[2][q];
+									weights[x] += weight;
+								}
+							}
+						}
+
+						for (int x = 0; x < w; x++) { // the centre tap always has a positive weight
+							for (int c = 0; c < 3; c++) filtered[c][y * w + x] = sum[c][x] / weights[x];
+						}
+					}
+				});
+			}
+	};
+}
@@ -4,10 +4,11 @@
 #include <glm/glm.hpp>
 #include <fstream>  
 #include <stdlib.h>     /* div, div_t */
-#include "omp.h"
 #include <glm/gtx/string_cast.hpp> // to_string mat4
 
 #include "sampler.h"  
+#include "threadpool.h"
+#include "trace.h"
 
 #define TINYEXR_IMPLEMENTATION
 #include "tinyexr.h"
@@ -38,6 +39,7 @@ class EnvMap {
 	
 		EnvMap(std::string name, float exposure) : exposure(exposure) {
 			std::cout << "Extracting environment map ... " << std::endl;
+			RTT_TRACE_SCOPE("envmap load");
 
 			const char* input = name.c_str();
 			float* out; // width * height * RGBA
@@ -77,28 +79,56 @@ class EnvMap {
 		
 		void calculateEnvironmentMap(float exp) 
 		{
+			RTT_TRACE_SCOPE("envmap");
 			exposure = exp;
+			const float k = std::pow(2.f, exposure + 2.47393f);
+			const unsigned int texels = envmap.size();
+
+			rtt::ThreadPool &pool = rtt::threadPool();
+			const unsigned int chunks = pool.size();
+			const unsigned int chunkSize = (texels + chunks - 1) / chunks;
+			std::vector<float> chunkLuminance(chunks, 0.f);
+			std::vector<float> chunkSolidAngleLuminance(chunks, 0.f);
+
+			// running luminance inside every chunk, the chunks are offset once all of them are known
+			pool.parallelFor(chunks, [&](unsigned int c, unsigned int) {
+				float luminance = 0.f;
+				for (unsigned int i = c * chunkSize; i < std::min(texels, (c + 1) * chunkSize); i++) {
+					envmap[i] = glm::min(envmapOriginal[i] * k / 3.f, glm::vec3(1.f));
+					luminance += (envmap[i].x + envmap[i].y + envmap[i].z) / 3.f;
+					envmapPDF[i] = luminance;
+				}
+				chunkLuminance[c] = luminance;
+			});
+
 			float luminance = 0.f;
-			float solidAngleLuminance = 0.f;
-			float k = std::pow(2.f, exposure + 2.47393f);
-			// TODO: use parallel
-			for (unsigned int i = 0; i < envmap.size(); i++) {
-				envmap[i] = glm::min(envmapOriginal[i] * k / 3.f, glm::vec3(1.f));
-				luminance += (envmap[i].x + envmap[i].y + envmap[i].z) / 3.f;
-				envmapPDF[i] = luminance;
+			for (unsigned int c = 0; c < chunks; c++) {
+				const float chunk = chunkLuminance[c];
+				chunkLuminance[c] = luminance;
+				luminance += chunk;
 			}
-			
+
 			// normalize envmap PDF
-			for (unsigned int i = 0; i < envmapPDF.size(); i++) {
-				envmapPDF[i] /= luminance; // cmf --> in texture space
-				envmapSolidAnglePDF[i] = getSolidAnglePDF(i);
-				solidAngleLuminance += envmapSolidAnglePDF[i];
-			}
+			pool.parallelFor(chunks, [&](unsigned int c, unsigned int) {
+				for (unsigned int i = c * chunkSize; i < std::min(texels, (c + 1) * chunkSize); i++)
+					envmapPDF[i] = (envmapPDF[i] + chunkLuminance[c]) / luminance; // cmf --> in texture space
+			});
+
+			// the solid angle pdf reads the previous texel of the cmf, so it needs its own pass
+			pool.parallelFor(chunks, [&](unsigned int c, unsigned int) {
+				for (unsigned int i = c * chunkSize; i < std::min(texels, (c + 1) * chunkSize); i++) {
+					envmapSolidAnglePDF[i] = getSolidAnglePDF(i);
+					chunkSolidAngleLuminance[c] += envmapSolidAnglePDF[i];
+				}
+			});
 
-			#pragma omp parallel for simd
-			for (unsigned int i = 0; i < envmapSolidAnglePDF.size(); i++) {
-				envmapSolidAnglePDF[i] /= solidAngleLuminance; // cmf --> in sphere space
-			}
+			float solidAngleLuminance = 0.f;
+			for (unsigned int c = 0; c < chunks; c++) solidAngleLuminance += chunkSolidAngleLuminance[c];
+
+			pool.parallelForRange(texels, 4096, [&](unsigned int begin, unsigned int end, unsigned int) {
+				for (unsigned int i = begin; i < end; i++)
+					envmapSolidAnglePDF[i] /= solidAngleLuminance; // cmf --> in sphere space
+			});
 		}
 
 		// evaluatuion
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+#include "threadpool.h"
+
+namespace rtt
+{
+	// Float accumulation buffer for progressive and adaptive rendering.
+	// Every pixel keeps its radiance sum, the sum of squared luminances and its own sample count,
+	// so passes may add samples to a subset of the pixels only.
+	class Film {
+		public:
+			unsigned int width;
+			unsigned int height;
+			std::vector<glm::vec3> accumulated; // sum of radiance samples
+			std::vector<float> luminanceSq; // sum of squared sample luminances, for the variance
+			std::vector<unsigned int> pixelSamples;
+			std::vector<unsigned char> active; // pixels that still receive samples
+			std::vector<glm::vec3> normals; // sums of the first-hit features of the samples, for the denoiser
+			std::vector<glm::vec3> albedos;
+			std::vector<float> depths;
+			unsigned int samples; // samples per pixel of the active pixels
+			unsigned int activePixels;
+
+			Film(unsigned int width, unsigned int height) : width(width), height(height), accumulated(width * height), luminanceSq(width * height), pixelSamples(width * height), active(width * height), normals(width * height), albedos(width * height), depths(width * height) { reset(); }
+
+			void reset() {
+				std::fill(accumulated.begin(), accumulated.end(), glm::vec3(0.f));
+				std::fill(luminanceSq.begin(), luminanceSq.end(), 0.f);
+				std::fill(pixelSamples.begin(), pixelSamples.end(), 0u);
+				std::fill(active.begin(), active.end(), 1);
+				std::fill(normals.begin(), normals.end(), glm::vec3(0.f));
+				std::fill(albedos.begin(), albedos.end(), glm::vec3(0.f));
+				std::fill(depths.begin(), depths.end(), 0.f);
+				samples = 0;
+				activePixels = width * height;
+			}
+
+			static float luminance(const glm::vec3 &c) {
+				return (c.x + c.y + c.z) / 3.f;
+			}
+
+			// called by the tile owning the pixel
+			void addSamples(unsigned int pixel, const glm::vec3 &sum, float sumSq, unsigned int spp) {
+				accumulated[pixel] += sum;
+				luminanceSq[pixel] += sumSq;
+				pixelSamples[pixel] += spp;
+			}
+
+			void addFeatures(unsigned int pixel, const glm::vec3 &normal, const glm::vec3 &albedo, float depth) {
+				normals[pixel] += normal;
+				albedos[pixel] += albedo;
+				depths[pixel] += depth;
+			}
+
+			// standard error of the pixel mean relative to its luminance
+			float relativeError(unsigned int pixel) const {
+				const float n = pixelSamples[pixel];
+				if (n < 2.f) return std::numeric_limits<float>::max();
+				const float mean = luminance(accumulated[pixel]) / n;
+				const float variance = std::max(0.f, (luminanceSq[pixel] / n - mean * mean) * n / (n - 1.f));
+				return std::sqrt(variance / n) / (mean + 1e-3f);
+			}
+
+			// deactivates the pixels whose error is below the threshold, returns the number of pixels left
+			unsigned int updateActive(float threshold) {
+				std::vector<unsigned int> chunkActive(threadPool().size(), 0u);
+				threadPool().parallelForRange(active.size(), 4096, [&](unsigned int begin, unsigned int end, unsigned int thread) {
+					for (unsigned int i = begin; i < end; i++) {
+						if (active[i] && relativeError(i) <= threshold) active[i] = 0;
+						chunkActive[thread] += active[i];
+					}
+				});
+				activePixels = 0;
+				for (unsigned int n : chunkActive) activePixels += n;
+				return activePixels;
+			}
+
+			unsigned long totalSamples() const {
+				unsigned long total = 0;
+				for (unsigned int n : pixelSamples) total += n;
+				return total;
+			}
+
+			void resolve(std::vector<glm::vec3> &image) const {
+				threadPool().parallelForRange(accumulated.size(), 4096, [&](unsigned int begin, unsigned int end, unsigned int) {
+					for (unsigned int i = begin; i < end; i++)
+						image[i] = pixelSamples[i] > 0 ? accumulated[i] / (float) pixelSamples[i] : glm::vec3(0.f);
+				});
+			}
+
+			// blue (0) to green to red (1)
+			static glm::vec3 heatmapColor(float t) {
+				return glm::vec3(std::clamp(2.f * t - 0.5f, 0.f, 1.f), std::clamp(1.5f - std::abs(2.f * t - 1.f) * 1.5f, 0.f, 1.f), std::clamp(1.5f - 2.f * t, 0.f, 1.f));
+			}
+
+			// false colour sample counts: blue for the fewest samples to red for the most (log scale)
+			void resolveSampleHeatmap(std::vector<glm::vec3> &image) const {
+				const unsigned int maxSamples = *std::max_element(pixelSamples.begin(), pixelSamples.end());
+				const float scale = 1.f / std::max(1.f, std::log2((float) maxSamples));
+				threadPool().parallelForRange(accumulated.size(), 4096, [&](unsigned int begin, unsigned int end, unsigned int) {
+					for (unsigned int i = begin; i < end; i++) {
+						const float t = std::log2((float) std::max(1u, pixelSamples[i])) * scale;
+						image[i] = heatmapColor(t);
+					}
+				});
+			}
+	};
+}
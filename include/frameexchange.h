@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+
+#include <glm/glm.hpp>
+
+namespace rtt
+{
+	// Lock-free triple buffer between the render thread (producer) and the GUI (consumer).
+	// The producer owns the back buffer, the consumer the front buffer, and the third one sits in between:
+	// publish() exchanges the back buffer with it, acquire() exchanges it with the front buffer if a newer frame was published.
+	// Neither side ever waits, and the consumer only ever sees complete frames.
+	class FrameExchange {
+		private:
+			static constexpr unsigned int indexMask = 3u;
+			static constexpr unsigned int newFrame = 4u; // set when the middle buffer holds a frame the consumer has not taken
+
+			std::vector<glm::vec3> buffers[3];
+			std::atomic<unsigned int> middle{1u};
+			unsigned int back = 0u;
+			unsigned int front = 2u;
+			std::atomic<unsigned long> published{0ul};
+
+		public:
+			explicit FrameExchange(unsigned int pixels) {
+				for (auto &buffer : buffers) buffer.assign(pixels, glm::vec3(0.f));
+			}
+
+			FrameExchange(const FrameExchange &) = delete;
+			FrameExchange& operator=(const FrameExchange &) = delete;
+
+			// render thread only
+			std::vector<glm::vec3>& backBuffer() { return buffers[back]; }
+
+			// render thread only: the back buffer becomes the latest frame, and the producer gets a free buffer back
+			void publish() {
+				back = middle.exchange(back | newFrame, std::memory_order_acq_rel) & indexMask;
+				published.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			// GUI thread only: returns true if the front buffer was replaced by a newer frame
+			bool acquire() {
+				if ((middle.load(std::memory_order_relaxed) & newFrame) == 0) return false;
+				front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+				return true;
+			}
+
+			// GUI thread only
+			const std::vector<glm::vec3>& frontBuffer() const { return buffers[front]; }
+
+			// number of frames published so far
+			unsigned long version() const { return published.load(std::memory_order_relaxed); }
+	};
+}
@@ -1,14 +1,18 @@
+#pragma once
+
 #include <vector>
 #include <glm/glm.hpp>
 
+#include "frameexchange.h"
+
 using namespace glm;
 using namespace std;
 
 class GUI {
 	public:
-		bool changed;
+		bool changed; // restarts the accumulation
 		bool changedMap;
-		bool quit;
+		bool updated; // parameters that keep the accumulation going (target spp, display options)
 
 		unsigned int width;
 		unsigned int height;
@@ -21,13 +25,26 @@ class GUI {
 
 		int spp;
 		int depth;
+		int rouletteDepth; // bounces before Russian roulette may end a path, 0 disables it
+
+		bool progressive;
+		float timeBudget; // seconds per accumulation, 0 for none
+		bool adaptive;
+		float errorThreshold; // relative standard error under which a pixel stops receiving samples
+		bool showSampleHeatmap;
+		bool denoise;
+
+		const char* samplers[3] = {"Independent", "Sobol (Owen scrambled)", "Padded 2D Sobol"};
+		int curr_sampler;
 
 		const char* materials[5] = {"Normals", "Perfectly Flat Mirror", "Perfect Diffuse", "Cook-Torrance: Dielectric", "Cook-Torrance: Conductor"};
 		int curr_material;
+		bool sceneMaterials; // shade every shape with its material from the scene file instead (not with PPG)
 
 		float roughness;
 		glm::vec3 diffColor;
 		float refIndex;
+		bool exactFresnel; // validation: exact Fresnel terms instead of the tables
 		
 		const char* metals[5] = {"Silver", "Gold", "Copper", "Zinc", "Cobalt"};
 		int curr_metal;
@@ -42,10 +59,10 @@ class GUI {
 		int c;
 		float t;
 
-		GUI() : changed(true), quit(false), width(640), height(480), angleFOV(60.0f * M_PI /180.f), cameraOrigin(vec3{0.f, 0.f, -2.f}), cameraAngle(vec3{0.f, 0.f, 0.f}), envmapExposure(-1.f), spp(0), depth(5), curr_material(2), roughness(0.02f), diffColor(0.3f), refIndex(1.5f), curr_metal(0), ppg(false), iterationNumber(4), mode(0), c(12000), t(0.01f) {}
+		GUI() : changed(true), changedMap(false), updated(false), width(640), height(480), angleFOV(60.0f * M_PI /180.f), cameraOrigin(vec3{0.f, 0.f, -2.f}), cameraAngle(vec3{0.f, 0.f, 0.f}), envmapExposure(-1.f), spp(0), depth(5), rouletteDepth(3), progressive(true), timeBudget(0.f), adaptive(false), errorThreshold(0.02f), showSampleHeatmap(false), denoise(false), curr_sampler(1), curr_material(2), sceneMaterials(false), roughness(0.02f), diffColor(0.3f), refIndex(1.5f), exactFresnel(false), curr_metal(0), ppg(false), iterationNumber(4), mode(0), c(12000), t(0.01f) {}
 
 		// r = 665nm; g = 550nm; b = 470nm
-		glm::vec3 getMetalEta(int metal) {
+		glm::vec3 getMetalEta(int metal) const {
 			switch (metal) {
 				case 0: // Silver
 					return glm::vec3{0.048778, 0.059582, 0.049317};
@@ -63,7 +80,7 @@ class GUI {
 				
 		}
 
-		glm::vec3 getMetalKappa(int metal) {
+		glm::vec3 getMetalKappa(int metal) const {
 			switch (metal) {
 				case 0: // Silver
 					return glm::vec3{4.5264, 3.5974, 2.8545};
@@ -82,4 +99,5 @@ class GUI {
 		}
 };
 
-void view_gui(const vector<vec3> &image, GUI & gui);
+namespace rtt { class ParameterChannel; }
+void view_gui(rtt::FrameExchange &frames, GUI & gui, rtt::ParameterChannel &parameters);
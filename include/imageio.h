@@ -0,0 +1,129 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+
+#include "tinyexr.h"
+#include "miniz.h" // vendored with tinyexr
+#include "tile.h"
+
+namespace rtt
+{
+	inline bool hasExtension(const std::string &path, const std::string &extension) {
+		return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+	}
+
+	// clamped 8-bit RGB, the conversion vectorizes
+	inline void toBytes(const glm::vec3 *pixels, unsigned char *bytes, unsigned int count) {
+		const float *values = &pixels[0].x;
+		#pragma omp simd
+		for (unsigned int i = 0; i < 3 * count; i++)
+			bytes[i] = (unsigned char)(std::min(std::max(values[i], 0.f), 1.f) * 255.f);
+	}
+
+	inline bool writeBytes(const std::string &path, const void *data, size_t size) {
+		FILE *file = std::fopen(path.c_str(), "wb");
+		const bool written = file != nullptr && std::fwrite(data, 1, size, file) == size;
+		if (file != nullptr) std::fclose(file);
+		if (!written) std::cout << "cannot write " << path << std::endl;
+		return written;
+	}
+
+	inline bool writePPM(const std::string &path, const std::vector<glm::vec3> &image, unsigned int width, unsigned int height) {
+		const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+		std::vector<unsigned char> bytes(header.begin(), header.end());
+		bytes.resize(header.size() + 3 * width * height);
+		toBytes(image.data(), bytes.data() + header.size(), width * height);
+		return writeBytes(path, bytes.data(), bytes.size());
+	}
+
+	inline bool writePNG(const std::string &path, const std::vector<glm::vec3> &image, unsigned int width, unsigned int height) {
+		std::vector<unsigned char> bytes(3 * width * height);
+		toBytes(image.data(), bytes.data(), width * height);
+		size_t size = 0;
+		void *png = tdefl_write_image_to_png_file_in_memory_ex(bytes.data(), width, height, 3, &size, MZ_BEST_SPEED, false);
+		if (png == nullptr) {
+			std::cout << "cannot encode " << path << std::endl;
+			return false;
+		}
+		const bool written = writeBytes(path, png, size);
+		mz_free(png);
+		return written;
+	}
+
+	// linear float, no clamping
+	inline bool writeEXR(const std::string &path, const std::vector<glm::vec3> &image, unsigned int width, unsigned int height) {
+		const char *err = nullptr;
+		if (SaveEXR(&image[0].x, width, height, 3, 0, path.c_str(), &err) != TINYEXR_SUCCESS) {
+			std::cout << "cannot write " << path << ": " << (err != nullptr ? err : "") << std::endl;
+			FreeEXRErrorMessage(err);
+			return false;
+		}
+		return true;
+	}
+
+	// format from the extension: .exr (linear float), .png or .ppm (clamped 8-bit)
+	inline bool writeImage(const std::string &path, const std::vector<glm::vec3> &image, unsigned int width, unsigned int height) {
+		if (hasExtension(path, ".exr")) return writeEXR(path, image, width, height);
+		if (hasExtension(path, ".png")) return writePNG(path, image, width, height);
+		return writePPM(path, image, width, height);
+	}
+
+	// Image file written tile by tile as the tiles finish, so that the frame never has to be held in memory.
+	// Only formats with a fixed-size header and uncompressed rows allow it: .pfm (linear float, host byte order,
+	// bottom row first) and .ppm (clamped 8-bit). Tiles may be written from several threads at once.
+	class TiledImageFile {
+		private:
+			int fd;
+			bool floats;
+			unsigned int width, height;
+			off_t headerSize;
+
+		public:
+			TiledImageFile(const std::string &path, unsigned int width, unsigned int height) : floats(hasExtension(path, ".pfm")), width(width), height(height) {
+				const std::string header = (floats ? "PF\n" : "P6\n") + std::to_string(width) + " " + std::to_string(height) + (floats ? "\n-1.0\n" : "\n255\n");
+				headerSize = header.size();
+				fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0 || write(fd, header.data(), header.size()) != (ssize_t) header.size() || ftruncate(fd, headerSize + (off_t) width * height * pixelSize()) != 0) {
+					std::cout << "cannot write " << path << std::endl;
+					close();
+				}
+			}
+			TiledImageFile(const TiledImageFile &) = delete;
+			TiledImageFile& operator=(const TiledImageFile &) = delete;
+			~TiledImageFile() { close(); }
+
+			bool valid() const { return fd >= 0; }
+
+			void close() {
+				if (fd >= 0) ::close(fd);
+				fd = -1;
+			}
+
+			// the rows of the tile one after the other
+			bool writeTile(const Tile &tile, const glm::vec3 *pixels) {
+				const unsigned int tileWidth = tile.x1 - tile.x0;
+				std::vector<unsigned char> row(tileWidth * pixelSize());
+				for (unsigned int y = tile.y0; y < tile.y1; y++) {
+					const glm::vec3 *src = pixels + (y - tile.y0) * tileWidth;
+					if (floats) std::copy(&src[0].x, &src[0].x + 3 * tileWidth, reinterpret_cast<float*>(row.data()));
+					else toBytes(src, row.data(), tileWidth);
+					const unsigned int fileRow = floats ? height - 1 - y : y;
+					const off_t offset = headerSize + ((off_t) fileRow * width + tile.x0) * pixelSize();
+					if (pwrite(fd, row.data(), row.size(), offset) != (ssize_t) row.size()) return false;
+				}
+				return true;
+			}
+
+		private:
+			unsigned int pixelSize() const { return floats ? 3 * sizeof(float) : 3; }
+	};
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "film.h"
+
+// Traversal counters of the BVH and cost per pixel, compiled in with -DRTT_INSTRUMENT (cmake -DRTT_INSTRUMENT=ON).
+// Without it RTT_COUNT and RTT_COUNT_RAY expand to nothing and the renderer is unchanged.
+namespace rtt
+{
+	enum RayType { Ray_Primary = 0, Ray_Bounce = 1, Ray_Shadow = 2 };
+
+	class TraversalCounters {
+		public:
+			unsigned long nodes = 0; // BVH nodes visited
+			unsigned long boxes = 0; // bounding volumes tested
+			unsigned long triangles = 0; // triangles tested
+			unsigned long rays[3] = {0, 0, 0}; // per RayType
+
+			TraversalCounters& operator+=(const TraversalCounters &counters) {
+				nodes += counters.nodes;
+				boxes += counters.boxes;
+				triangles += counters.triangles;
+				for (int i = 0; i < 3; i++) rays[i] += counters.rays[i];
+				return *this;
+			}
+
+			// work of the traversal, what the cost heatmap shows
+			unsigned long cost() const { return boxes + triangles; }
+
+			void print() const {
+				const unsigned long total = std::max(1ul, rays[Ray_Primary] + rays[Ray_Bounce] + rays[Ray_Shadow]);
+				std::cout << "rays: " << rays[Ray_Primary] << " primary, " << rays[Ray_Bounce] << " bounce, " << rays[Ray_Shadow] << " shadow" << std::endl;
+				std::cout << "per ray: " << nodes / (float) total << " nodes, " << boxes / (float) total << " boxes, " << triangles / (float) total << " triangles" << std::endl;
+			}
+	};
+
+#ifdef RTT_INSTRUMENT
+	// the counters of every thread that traced rays, the ones of finished threads are kept in retired
+	class CounterRegistry {
+		public:
+			std::mutex mutex;
+			std::vector<TraversalCounters*> threads;
+			TraversalCounters retired;
+	};
+	CounterRegistry counterRegistry;
+
+	class ThreadCounters {
+		public:
+			TraversalCounters counters;
+			ThreadCounters() {
+				std::lock_guard<std::mutex> lock(counterRegistry.mutex);
+				counterRegistry.threads.push_back(&counters);
+			}
+			~ThreadCounters() {
+				std::lock_guard<std::mutex> lock(counterRegistry.mutex);
+				counterRegistry.retired += counters;
+				counterRegistry.threads.erase(std::find(counterRegistry.threads.begin(), counterRegistry.threads.end(), &counters));
+			}
+	};
+
+	TraversalCounters& threadCounters() {
+		thread_local ThreadCounters local;
+		return local.counters;
+	}
+
+	// sum of the counters of all threads since the last merge, only while no frame is rendered
+	TraversalCounters mergeTraversalCounters() {
+		std::lock_guard<std::mutex> lock(counterRegistry.mutex);
+		TraversalCounters sum = counterRegistry.retired;
+		counterRegistry.retired = TraversalCounters();
+		for (TraversalCounters *counters : counterRegistry.threads) {
+			sum += *counters;
+			*counters = TraversalCounters();
+		}
+		return sum;
+	}
+
+	// traversal cost and time of every pixel, added up by renderNextFrame until reset
+	class PixelCosts {
+		public:
+			std::vector<float> traversal;
+			std::vector<float> seconds;
+
+			void reset(unsigned int pixels) {
+				traversal.assign(pixels, 0.f);
+				seconds.assign(pixels, 0.f);
+			}
+	};
+	PixelCosts pixelCosts;
+
+	// false colours up to the 99th percentile, so that a few outliers do not flatten the rest of the map
+	void resolveHeatmap(const std::vector<float> &values, std::vector<glm::vec3> &image) {
+		image.resize(values.size());
+		if (values.empty()) return;
+		std::vector<float> sorted(values);
+		std::nth_element(sorted.begin(), sorted.begin() + sorted.size() * 99 / 100, sorted.end());
+		const float scale = 1.f / std::max(sorted[sorted.size() * 99 / 100], std::numeric_limits<float>::min());
+		for (unsigned int i = 0; i < values.size(); i++) image[i] = Film::heatmapColor(std::min(values[i] * scale, 1.f));
+	}
+
+	#define RTT_COUNT(counter, n) (rtt::threadCounters().counter += (n))
+	#define RTT_COUNT_RAY(type) (rtt::threadCounters().rays[type]++)
+#else
+	#define RTT_COUNT(counter, n) ((void) 0)
+	#define RTT_COUNT_RAY(type) ((void) 0)
+#endif
+}
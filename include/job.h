@@ -0,0 +1,96 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "gui.h"
+#include "imageio.h"
+
+namespace rtt
+{
+	// Render job of the headless renderers: one line of key=value settings, every setting not given keeps its default (see GUI):
+	//   origin=x,y,z angle=x,y,z fov=degrees width=640 height=480 spp=64 depth=5 roulette=3 mode=bsdf|nee|mis
+	//   sampler=independent|sobol|padded2d material=normals|mirror|diffuse|dielectric|conductor
+	//   metal=silver|gold|copper|zinc|cobalt roughness=0.02 color=r,g,b ior=1.5 fresnel=table|exact materials=gui|scene exposure=-1 denoise=0|1
+	//   output=images/job.ppm (.exr, .png or .ppm, and .pfm for the distributed renderer)
+	class Job {
+		public:
+			GUI settings;
+			unsigned int spp = 64;
+			std::string output;
+	};
+
+	bool parseVec3(const std::string &value, glm::vec3 &v) {
+		return std::sscanf(value.c_str(), "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+	}
+
+	int parseName(const std::string &value, const std::vector<std::string> &names) {
+		for (unsigned int i = 0; i < names.size(); i++)
+			if (names[i] == value) return i;
+		return -1;
+	}
+
+	bool parseJob(const std::string &line, Job &job) {
+		std::istringstream tokens(line);
+		std::string token;
+		GUI &s = job.settings;
+		while (tokens >> token) {
+			const size_t eq = token.find('=');
+			if (eq == std::string::npos) {
+				std::cout << "expected key=value, got '" << token << "'" << std::endl;
+				return false;
+			}
+			const std::string key = token.substr(0, eq);
+			const std::string value = token.substr(eq + 1);
+			bool ok = true;
+			try {
+				if (key == "origin") ok = parseVec3(value, s.cameraOrigin);
+				else if (key == "angle") ok = parseVec3(value, s.cameraAngle);
+				else if (key == "fov") s.angleFOV = std::stof(value) * M_PI / 180.f;
+				else if (key == "width") s.width = std::stoul(value);
+				else if (key == "height") s.height = std::stoul(value);
+				else if (key == "spp") job.spp = std::stoul(value);
+				else if (key == "depth") s.depth = std::stoi(value);
+				else if (key == "roulette") s.rouletteDepth = std::stoi(value);
+				else if (key == "mode") ok = (s.mode = parseName(value, {"bsdf", "nee", "mis"})) >= 0;
+				else if (key == "sampler") ok = (s.curr_sampler = parseName(value, {"independent", "sobol", "padded2d"})) >= 0;
+				else if (key == "material") ok = (s.curr_material = parseName(value, {"normals", "mirror", "diffuse", "dielectric", "conductor"})) >= 0;
+				else if (key == "metal") ok = (s.curr_metal = parseName(value, {"silver", "gold", "copper", "zinc", "cobalt"})) >= 0;
+				else if (key == "roughness") s.roughness = std::stof(value);
+				else if (key == "color") ok = parseVec3(value, s.diffColor);
+				else if (key == "ior") s.refIndex = std::stof(value);
+				else if (key == "fresnel") {
+					const int fresnel = parseName(value, {"table", "exact"});
+					ok = fresnel >= 0;
+					s.exactFresnel = fresnel == 1;
+				}
+				else if (key == "materials") {
+					const int materials = parseName(value, {"gui", "scene"});
+					ok = materials >= 0;
+					s.sceneMaterials = materials == 1;
+				}
+				else if (key == "exposure") s.envmapExposure = std::stof(value);
+				else if (key == "denoise") s.denoise = std::stoi(value) != 0;
+				else if (key == "output") job.output = value;
+				else {
+					std::cout << "unknown key '" << key << "'" << std::endl;
+					return false;
+				}
+			} catch (const std::exception &) {
+				ok = false;
+			}
+			if (!ok || job.spp == 0 || s.width == 0 || s.height == 0) {
+				std::cout << "invalid value for '" << key << "': '" << value << "'" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+namespace rtt
+{
+	// Fresnel reflectance tabulated over cos theta in [cosMin, 1] when the material is created, and looked up with linear
+	// interpolation instead of the exact formula on every sample and evaluation.
+	// With sqrtSpacing the entries are spaced evenly in sqrt(cos theta - cosMin) instead, for the square root singularity
+	// at the critical angle (cosMin) when leaving a dielectric.
+	template<class T, bool sqrtSpacing = false>
+	class FresnelTable {
+		public:
+			static constexpr unsigned int size = 512;
+			std::array<T, size + 1> values;
+			float cosMin = 0.f;
+			float scale = 1.f;
+
+			template<class Function>
+			void build(const Function &fresnel, float cosineMin = 0.f) {
+				cosMin = cosineMin;
+				scale = 1.f / (1.f - cosMin);
+				for (unsigned int i = 0; i <= size; i++) {
+					const float u = i / (float) size;
+					values[i] = fresnel(cosMin + (sqrtSpacing ? u * u : u) * (1.f - cosMin));
+				}
+			}
+
+			T lookup(float cosine) const {
+				float u = std::min(std::max((cosine - cosMin) * scale, 0.f), 1.f);
+				if constexpr (sqrtSpacing) u = std::sqrt(u);
+				const float x = u * size;
+				const unsigned int i = std::min((unsigned int) x, size - 1);
+				const float t = x - i;
+				return values[i] * (1.f - t) + values[i + 1] * t;
+			}
+	};
+}
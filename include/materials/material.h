@@ -25,5 +25,6 @@ namespace rtt
 		virtual glm::vec3 sample(BSDF &bsdf, Sampler &sampler, bool ppg) const = 0;
 		virtual glm::vec3 evaluate(BSDF &bsdf) const = 0;
 		virtual float pdf(BSDF &bsdf) const = 0;
+		virtual glm::vec3 albedo() const { return glm::vec3(1.f); } // reflectance guiding the denoiser
 	};
 }
@@ -2,10 +2,11 @@
 #include <complex>
 
 #include "material.h"
+#include "fresnel.h"
 
 namespace rtt
 {
-	class Material_conductor : public Material {
+	class Material_conductor final : public Material {
 		public: 
 			int type;
 			float alpha; //roughness - 0 for mirror
@@ -13,7 +14,11 @@ namespace rtt
 			glm::vec3 kappa; // Absorption coeff
 			glm::vec3 air_eta;
 			glm::vec3 air_kappa;
-			Material_conductor(float roughness, glm::vec3 eta, glm::vec3 kappa) : alpha(roughness), eta(eta), kappa(kappa), air_eta(glm::vec3(1.f)), air_kappa(glm::vec3(0.f)) {}
+			bool exactFresnel; // evaluate the formula on every call instead of the table, for validation
+			FresnelTable<glm::vec3> fresnelTable;
+			Material_conductor(float roughness, glm::vec3 eta, glm::vec3 kappa, bool exactFresnel = false) : alpha(roughness), eta(eta), kappa(kappa), air_eta(glm::vec3(1.f)), air_kappa(glm::vec3(0.f)), exactFresnel(exactFresnel) {
+				fresnelTable.build([this](float cosi) { return fresnelExact(cosi); });
+			}
 
 	float fresnel(std::complex<float> ior1, std::complex<float> ior2, float cosine) const {	
 		const std::complex<float> cosi = cosine;
@@ -26,13 +31,17 @@ namespace rtt
 		return std::min(1.f, (rs_sqrt * rs_sqrt + rp_sqrt * rp_sqrt) / 2.f);
 	}
 
-	glm::vec3 fresnel(const float cosi) const {
+	glm::vec3 fresnelExact(const float cosi) const {
 		return glm::vec3(
 			fresnel(std::complex<float>(air_eta.x, air_kappa.x), std::complex<float>(eta.x, kappa.x), cosi),
 			fresnel(std::complex<float>(air_eta.y, air_kappa.y), std::complex<float>(eta.y, kappa.y), cosi),
 			fresnel(std::complex<float>(air_eta.z, air_kappa.z), std::complex<float>(eta.z, kappa.z), cosi)
 			);
 	}
+
+	glm::vec3 fresnel(const float cosi) const {
+		return exactFresnel ? fresnelExact(cosi) : fresnelTable.lookup(cosi);
+	}
 // This can be used for visible normal distribution and the pdf
 	float normal_distribution(const glm::vec3 h) const { // from GGX
 		//if (h.z <= 0) return 0.f; // xhi+(m,n) ---> <surface and microfacet normals> for debugging
@@ -59,28 +68,19 @@ namespace rtt
 		if (ppg) return sample_PPG(bsdf);		
 
 		glm::vec3 wi = bsdf.wi;
-		glm::vec3 h = sampleGGXnormalD(std::ref(sampler), alpha);
+		if (wi.z <= 0.f) return glm::vec3(0.f);
+		glm::vec3 h = sampleGGXVisibleNormal(std::ref(sampler), wi, alpha);
 		bsdf.wo = glm::normalize(2.f * glm::dot(h, wi) * h - wi);
-		
-		float cosine = glm::dot(h, wi);
-		if (cosine <= 0.f) {
-			//std::cout << cosine << std::endl;
-			return glm::vec3(0.f);
-		}
+		if (bsdf.wo.z <= 0.f) return glm::vec3(0.f);
 
-		// evaluate
-		const glm::vec3 F = fresnel(glm::dot(bsdf.wo, h));
-		//const float D = normal_distribution(h);
-		const float G = G1(wi) * G1(bsdf.wo);
-
-		return glm::vec3((F * G * cosine) / (wi.z * h.z)); // cos * bsdf / pdf
+		// D and G1(wi) cancel with the visible normal pdf
+		return fresnel(glm::dot(bsdf.wo, h)) * G1(bsdf.wo); // cos * bsdf / pdf
 	}
 
 	glm::vec3 evaluate(BSDF &bsdf) const override {
 		//if (bsdf.wo.z <= 0.f) return glm::vec3(0.f);
 		glm::vec3 h = glm::normalize(bsdf.wi + bsdf.wo);
 		if (h.z * bsdf.wo.z <= 0.f) return glm::vec3(0.f);
-		float cosine = glm::dot(h, bsdf.wi);
 
 		// evaluate
 		const glm::vec3 F = fresnel(glm::dot(bsdf.wo, h));
@@ -93,10 +93,14 @@ namespace rtt
 	float pdf(BSDF &bsdf) const  override{
 		//if (bsdf.wo.z <= 0.f) return 0.f;
 		glm::vec3 h = glm::normalize(bsdf.wi + bsdf.wo);
-		if (h.z * bsdf.wo.z <= 0.f) return 0.f;
+		if (h.z * bsdf.wo.z <= 0.f || bsdf.wi.z <= 0.f) return 0.f;
 		const float D = normal_distribution(h); 
 
-		return D * h.z / (4.f * bsdf.wo.z);
+		return G1(bsdf.wi) * D / (4.f * bsdf.wi.z); // visible normal pdf / (4 <wo,h>)
+	}
+
+	glm::vec3 albedo() const override {
+		return fresnel(1.f); // reflectance at normal incidence
 	}
 
 	};
@@ -1,18 +1,39 @@
 #pragma once
 
 #include "material.h"
+#include "fresnel.h"
 
 namespace rtt
 {
-	class Material_dielectric : public Material {
+	class Material_dielectric final : public Material {
 		public: 
 			int type;
 			float alpha; //roughness - 0 for mirror
 			float eta1; // IOR (real)
 			float eta2;
-			Material_dielectric(float roughness, float eta) : alpha(roughness), eta1(1.f), eta2(eta) {}
+			bool exactFresnel; // evaluate the formula on every call instead of the tables, for validation
+			FresnelTable<float> fresnelEntering; // eta1 to eta2
+			FresnelTable<float, true> fresnelLeaving; // eta2 to eta1, total internal reflection below the critical angle
+			float cosCritical[2]; // total internal reflection below
+			Material_dielectric(float roughness, float eta, bool exactFresnel = false) : alpha(roughness), eta1(1.f), eta2(eta), exactFresnel(exactFresnel) {
+				bool tir;
+				cosCritical[0] = eta1 > eta2 ? std::sqrt(1.f - (eta2 / eta1) * (eta2 / eta1)) : 0.f;
+				cosCritical[1] = eta2 > eta1 ? std::sqrt(1.f - (eta1 / eta2) * (eta1 / eta2)) : 0.f;
+				fresnelEntering.build([&](float cosine) { return fresnelExact(cosine, tir, eta1, eta2); }, cosCritical[0]);
+				fresnelLeaving.build([&](float cosine) { return fresnelExact(cosine, tir, eta2, eta1); }, cosCritical[1]);
+			}
 
 	float fresnel(float cosine, bool &tir, float tmp_eta1, float tmp_eta2) const {
+		if (exactFresnel) return fresnelExact(cosine, tir, tmp_eta1, tmp_eta2);
+		const int side = tmp_eta1 != eta1; // the etas are swapped when leaving the object
+		if (cosine < cosCritical[side]) {
+			tir = true;
+			return 1.f;
+		}
+		return side == 0 ? fresnelEntering.lookup(cosine) : fresnelLeaving.lookup(cosine);
+	}
+
+	float fresnelExact(float cosine, bool &tir, float tmp_eta1, float tmp_eta2) const {
 		if (tmp_eta1 > tmp_eta2) {
 			const float sinTIR = tmp_eta2 / tmp_eta1;
 			const float sin_i = std::sqrt(1.f - cosine * cosine);
@@ -57,7 +78,8 @@ namespace rtt
 
 		glm::vec3 wi = bsdf.wi;
 		bool refraction = false;
-		glm::vec3 h = glm::normalize(sampleGGXnormalD(std::ref(sampler), alpha));
+		if (wi.z == 0.f) return glm::vec3(0.f);
+		glm::vec3 h = sampleGGXVisibleNormal(std::ref(sampler), wi.z < 0.f ? -wi : wi, alpha); // visible from the side of wi
 
 		float tmp_eta1 = eta1;
 		float tmp_eta2 = eta2;
@@ -101,11 +123,9 @@ namespace rtt
 		float F = fresnel(abs(glm::dot(bsdf.wo, h)), tir, tmp_eta1, tmp_eta2);
 		if (refraction && !tir) F = 1.f - F; //std::cout << F << std::endl;}
 
-		//const float D = normal_distribution(h); 
-		const float G = G1(wi) * G1(bsdf.wo);
-
 		bsdf.inside = ((tmp_eta1 > tmp_eta2 && (tmp_eta1 * tmp_eta2 > 1.f)) || (tmp_eta2 > tmp_eta1 && (tmp_eta1 * tmp_eta2 < 1.f)));
-		return glm::vec3((F * G * cosine) / (bsdf.wi.z * h.z)); // cos * bsdf / pdf
+		// D, G1(wi) and the cosines cancel with the visible normal pdf
+		return glm::vec3(F * G1(bsdf.wo)); // cos * bsdf / pdf
 	}
 
 	glm::vec3 evaluate(BSDF &bsdf) const override {
@@ -132,10 +152,10 @@ namespace rtt
 
 	float pdf(BSDF &bsdf) const override {
 		glm::vec3 h = glm::normalize(bsdf.wi + bsdf.wo);
-		if (bsdf.wo.z * h.z <= 0.f) return 0.f;
+		if (bsdf.wo.z * h.z <= 0.f || bsdf.wi.z == 0.f) return 0.f;
 		const float D = normal_distribution(h); 
 
-		return D * h.z / (4.f * bsdf.wo.z);
+		return G1(bsdf.wi) * D / (4.f * std::abs(bsdf.wi.z)); // visible normal pdf / (4 <wo,h>)
 	}
 /*
 	glm::vec3 sample(BSDF &bsdf, Sampler &sampler) override {
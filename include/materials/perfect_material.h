@@ -4,7 +4,7 @@
 
 namespace rtt
 {
-	class Material_normal : public Material {
+	class Material_normal final : public Material {
 		public: 
 			int type;
 			Material_normal() {}
@@ -26,7 +26,7 @@ namespace rtt
 		}
 	};
 
-	class Material_mirror : public Material {
+	class Material_mirror final : public Material {
 		public: 
 			int type;
 			Material_mirror() {}
@@ -52,7 +52,7 @@ namespace rtt
 		}
 	};
 
-	class Material_diffuse : public Material {
+	class Material_diffuse final : public Material {
 		public:
 			int type;
 			glm::vec3 color;
@@ -66,8 +66,8 @@ namespace rtt
 
 		glm::vec3 sample(BSDF &bsdf, Sampler &sampler, bool ppg)const  override {
 			if (ppg) return sample_PPG(bsdf);
-			bsdf.wo = sampleHemisphere(std::ref(sampler));
-			return color * bsdf.wo.z * 2.f; // bsdf = albedo \ pi ;;;; bsdf * cos / pdf
+			bsdf.wo = sampleCosineHemisphere(std::ref(sampler));
+			return color; // bsdf = albedo \ pi ;;;; bsdf * cos / pdf, pdf = cos / pi
 		}
 
 		glm::vec3 evaluate(BSDF &bsdf) const override {
@@ -76,8 +76,11 @@ namespace rtt
 		}
 
 		float pdf(BSDF &bsdf) const  override {
-			(void) bsdf;
-			return 1.f / (2.f * M_PI);
+			return std::max(0.f, bsdf.wo.z) / (float) M_PI;
+		}
+
+		glm::vec3 albedo() const override {
+			return color;
 		}
 	};
 }
@@ -6,6 +6,7 @@
 
 #include "ray.h"
 #include "triangle.h"
+#include "instrument.h"
 
 namespace rtt
 {
@@ -28,12 +29,14 @@ namespace rtt
 	public:
 		std::vector<TriangleIndices<IndexSize>> triangles;
 		MeshIndices() = default;
-		MeshIndices(const std::vector<IndexSize> vertex_indices, const std::vector<IndexSize> normal_indices, const std::vector<IndexSize> uv_indices) 
+		// material_indices has one entry per triangle, missing entries get the first material
+		MeshIndices(const std::vector<IndexSize> vertex_indices, const std::vector<IndexSize> normal_indices, const std::vector<IndexSize> uv_indices, const std::vector<unsigned short> &material_indices = {}) 
 		{
 			for (unsigned int i = 0; i < vertex_indices.size() / 3; i++) {				
 				triangles.emplace_back(vertex_indices[3 * i], vertex_indices[3 * i + 1], vertex_indices[3 * i + 2],
 					normal_indices[3 * i], normal_indices[3 * i + 1], normal_indices[3 * i + 2],
-					uv_indices[3 * i], uv_indices[3 * i + 1], uv_indices[3 * i + 2]);
+					uv_indices[3 * i], uv_indices[3 * i + 1], uv_indices[3 * i + 2],
+					i < material_indices.size() ? material_indices[i] : 0);
 			}
 		}
 		MeshIndices(const std::vector<TriangleIndices<IndexSize>> triangles) : triangles(std::move(triangles)) {} 		
@@ -54,6 +57,7 @@ namespace rtt
 
 		void intersect(const Ray &ray, Intersection &its) const 
 		{ 
+			RTT_COUNT(triangles, triangles.size());
 			for (const auto & tri: triangles) tri.intersect(ray, its);
 		}	
 	};
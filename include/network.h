@@ -0,0 +1,135 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+namespace rtt
+{
+	// Blocking TCP connection exchanging messages of the distributed renderer: a header (type, payload size) and the payload.
+	// Both ends run the same build, so the integers and floats are sent in host byte order.
+	class Connection {
+		public:
+			enum Message { Message_Job, Message_Ready, Message_Tile, Message_Result, Message_Quit };
+			int fd;
+
+			explicit Connection(int fd = -1) : fd(fd) {
+				if (fd >= 0) {
+					int on = 1; // tiles are small messages, send them right away
+					setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+				}
+			}
+			Connection(Connection &&other) : fd(other.fd) { other.fd = -1; }
+			Connection& operator=(Connection &&other) {
+				std::swap(fd, other.fd);
+				return *this;
+			}
+			Connection(const Connection &) = delete;
+			Connection& operator=(const Connection &) = delete;
+			~Connection() { close(); }
+
+			bool valid() const { return fd >= 0; }
+
+			void close() {
+				if (fd >= 0) ::close(fd);
+				fd = -1;
+			}
+
+			bool send(uint32_t type, const void *data, uint32_t size) {
+				const uint32_t header[2] = {type, size};
+				return sendAll(header, sizeof(header)) && (size == 0 || sendAll(data, size));
+			}
+
+			bool send(uint32_t type, const std::string &text) {
+				return send(type, text.data(), text.size());
+			}
+
+			bool receive(uint32_t &type, std::vector<char> &payload) {
+				uint32_t header[2];
+				if (!receiveAll(header, sizeof(header))) return false;
+				type = header[0];
+				payload.resize(header[1]);
+				return header[1] == 0 || receiveAll(payload.data(), header[1]);
+			}
+
+		private:
+			bool sendAll(const void *data, size_t size) {
+				const char *bytes = static_cast<const char*>(data);
+				while (size > 0) {
+					const ssize_t sent = ::send(fd, bytes, size, 0);
+					if (sent <= 0) return false;
+					bytes += sent;
+					size -= sent;
+				}
+				return true;
+			}
+
+			bool receiveAll(void *data, size_t size) {
+				char *bytes = static_cast<char*>(data);
+				while (size > 0) {
+					const ssize_t received = ::recv(fd, bytes, size, 0);
+					if (received <= 0) return false;
+					bytes += received;
+					size -= received;
+				}
+				return true;
+			}
+	};
+
+	// returns the listening socket or -1
+	int listenOn(unsigned short port) {
+		const int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		sockaddr_in address;
+		std::memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(port);
+		if (bind(fd, (sockaddr*) &address, sizeof(address)) < 0 || listen(fd, 64) < 0) {
+			std::cout << "cannot listen on port " << port << ": " << std::strerror(errno) << std::endl;
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	Connection acceptConnection(int server) {
+		return Connection(accept(server, nullptr, nullptr));
+	}
+
+	// retries while the coordinator is not listening yet
+	Connection connectTo(const std::string &host, unsigned short port, int retries = 50) {
+		addrinfo hints, *result = nullptr;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || result == nullptr) {
+			std::cout << "cannot resolve " << host << std::endl;
+			return Connection();
+		}
+		for (int i = 0; i <= retries; i++) {
+			const int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+			if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) == 0) {
+				freeaddrinfo(result);
+				return Connection(fd);
+			}
+			if (fd >= 0) ::close(fd);
+			usleep(100000);
+		}
+		freeaddrinfo(result);
+		std::cout << "cannot connect to " << host << ":" << port << std::endl;
+		return Connection();
+	}
+}
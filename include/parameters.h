@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "gui.h"
+#include "cancel.h"
+
+namespace rtt
+{
+	// Render parameters handed from the GUI thread to the render thread as immutable snapshots.
+	// The render thread sleeps on the condition variable while it has nothing left to render,
+	// and a snapshot that restarts the accumulation also cancels the pass in flight.
+	class ParameterChannel {
+		private:
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::shared_ptr<const GUI> latest;
+			bool pending = false; // latest was not taken yet
+			bool quit = false;
+
+		public:
+			CancelToken cancel;
+			std::atomic<int> accumulatedSpp{0}; // written back by the render thread, shown by the GUI
+
+			// GUI thread: the restart flags of a snapshot that was not taken yet carry over to the new one
+			void publish(const GUI &gui) {
+				auto snapshot = std::make_shared<GUI>(gui);
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (pending) {
+						snapshot->changed |= latest->changed;
+						snapshot->changedMap |= latest->changedMap;
+					}
+					latest = snapshot;
+					pending = true;
+					if (snapshot->changed || snapshot->changedMap) cancel.cancel();
+				}
+				condition.notify_one();
+			}
+
+			void close() {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					quit = true;
+					cancel.cancel();
+				}
+				condition.notify_one();
+			}
+
+			// render thread: the newest snapshot if one was published since the last call, nullptr otherwise.
+			// With wait, sleeps until a snapshot is published or the channel is closed.
+			std::shared_ptr<const GUI> take(bool wait) {
+				std::unique_lock<std::mutex> lock(mutex);
+				if (wait) condition.wait(lock, [this] { return pending || quit; });
+				if (!pending || quit) return nullptr;
+				pending = false;
+				cancel.reset(); // under the lock, so a later restart is never missed
+				return latest;
+			}
+
+			bool closed() {
+				std::lock_guard<std::mutex> lock(mutex);
+				return quit;
+			}
+	};
+}
@@ -75,9 +75,9 @@ bool parseObject(const char *path, vector<vec3> &vertices, vector<vec2> &uvs, ve
 				normal_indices.push_back(size + normalIndex[1]-1);
 				normal_indices.push_back(size + normalIndex[2]-1);
 
-				ordered_vertices.push_back(vertices[vertexIndex[0]]);
-				ordered_vertices.push_back(vertices[vertexIndex[1]]);
-				ordered_vertices.push_back(vertices[vertexIndex[2]]);
+				ordered_vertices.push_back(vertices[size + vertexIndex[0]-1]);
+				ordered_vertices.push_back(vertices[size + vertexIndex[1]-1]);
+				ordered_vertices.push_back(vertices[size + vertexIndex[2]-1]);
 			}
 			else throw std::runtime_error("can't handle this representation yet: " + line);
 		}
@@ -86,9 +86,94 @@ bool parseObject(const char *path, vector<vec3> &vertices, vector<vec2> &uvs, ve
 	return true;
 }
 
+// material of a <bsdf> block, type as in GUI::materials (1 mirror, 2 diffuse, 3 dielectric, 4 conductor)
+class MaterialDescription
+{
+public:
+	std::string id;
+	int type = 2;
+	float roughness = 0.f;
+	vec3 color = vec3(0.5f);
+	float ior = 1.5f;
+	int metal = 0; // as in GUI::metals
+};
+
+vec3 parseColor(const tinyparser_mitsuba::Property &prop, const vec3 &def)
+{
+	const auto color = prop.getColor(tinyparser_mitsuba::Color{def.x, def.y, def.z});
+	return vec3(color.r, color.g, color.b);
+}
+
+// reflectance given as an rgb value or as a checkerboard texture (averaged)
+vec3 parseReflectance(const tinyparser_mitsuba::Object &bsdf, const std::string &name)
+{
+	const auto textures = bsdf.namedChildren();
+	const auto texture = textures.find(name);
+	if (texture != textures.end())
+		return 0.5f * (parseColor(texture->second->property("color0"), vec3(0.4f)) + parseColor(texture->second->property("color1"), vec3(0.2f)));
+	return parseColor(bsdf.property(name), vec3(0.5f));
+}
+
+// maps the Mitsuba plugins to the materials of the renderer, the closest one when there is no exact match
+MaterialDescription parseMaterial(const tinyparser_mitsuba::Object &bsdf)
+{
+	const std::string plugin = bsdf.pluginType();
+	if (plugin == "twosided" || plugin == "mask" || plugin == "bumpmap")
+	{
+		for (const auto & child : bsdf.anonymousChildren())
+			if (child->type() == 1) return parseMaterial(*child);
+	}
+
+	MaterialDescription material;
+	if (plugin == "diffuse" || plugin == "roughdiffuse")
+		material.color = parseReflectance(bsdf, "reflectance");
+	else if (plugin == "plastic" || plugin == "roughplastic") // no coating, only the diffuse base
+		material.color = parseReflectance(bsdf, "diffuseReflectance");
+	else if (plugin == "conductor" || plugin == "roughconductor")
+	{
+		material.type = 4;
+		material.roughness = plugin == "conductor" ? 0.f : bsdf.property("alpha").getNumber(0.1f);
+		const std::string name = bsdf.property("material").getString("Ag");
+		const std::vector<std::string> metals = {"Ag", "Au", "Cu", "Zn", "Co"};
+		const auto metal = std::find(metals.begin(), metals.end(), name);
+		material.metal = metal != metals.end() ? metal - metals.begin() : 0;
+	}
+	else if (plugin == "dielectric" || plugin == "thindielectric" || plugin == "roughdielectric")
+	{
+		material.type = 3;
+		material.roughness = plugin == "roughdielectric" ? bsdf.property("alpha").getNumber(0.1f) : 0.f;
+		material.ior = bsdf.property("intIOR").getNumber(1.5f) / bsdf.property("extIOR").getNumber(1.f);
+	}
+	else
+		std::cout << "bsdf " << plugin << " is not supported, using a diffuse material" << std::endl;
+	return material;
+}
+
+// index of the material of a shape in the table, parsed on first use
+unsigned short findMaterial(const tinyparser_mitsuba::Object &shape, vector<MaterialDescription> &materials)
+{
+	for (const auto & child : shape.anonymousChildren())
+	{
+		if (child->type() != 1) continue; //bsdf, referenced or inline
+		for (unsigned short i = 0; i < materials.size(); i++)
+			if (!child->id().empty() && materials[i].id == child->id()) return i;
+		materials.push_back(parseMaterial(*child));
+		materials.back().id = child->id();
+		return materials.size() - 1;
+	}
+	// shapes without a bsdf share a default material
+	for (unsigned short i = 0; i < materials.size(); i++)
+		if (materials[i].id == "default") return i;
+	materials.emplace_back();
+	materials.back().id = "default";
+	return materials.size() - 1;
+}
+
+// material_indices holds one entry per triangle, indexing materials
 template<class IndexSize>
 bool parseFile(const std::string &dir_path, const std::string &scene_name, vector<vec3> &vertices, vector<vec2> &uvs, vector< vec3> &normals,
-	vector<IndexSize> &vertex_indices, vector<IndexSize> &uv_indices, vector<IndexSize> &normal_indices, vector<vec3> &ordered_vertices)
+	vector<IndexSize> &vertex_indices, vector<IndexSize> &uv_indices, vector<IndexSize> &normal_indices, vector<vec3> &ordered_vertices,
+	vector<MaterialDescription> &materials, vector<unsigned short> &material_indices)
 	{
 		std::string path(dir_path + scene_name + ".xml");
 		tinyparser_mitsuba::SceneLoader loader;
@@ -117,6 +202,7 @@ bool parseFile(const std::string &dir_path, const std::string &scene_name, vecto
 					{
 						path = dir_path + prop.second.getString();
 						parseObject(path.c_str(), vertices, uvs, normals, vertex_indices, uv_indices, normal_indices, ordered_vertices);
+						material_indices.resize(vertex_indices.size() / 3, findMaterial(*ac, materials));
 						break;
 					}
 				}
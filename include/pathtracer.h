@@ -8,17 +8,20 @@
 #include "plane.h"
 #include "envmap.h"
 #include "bounding_volume.h"
+#include "instrument.h"
 
 #include "binarytree.h"
 #include <memory>
+#include <array>
+#include <type_traits>
 
 namespace rtt {
 
 	const float roughness_threshold = 0.019f;
 
-	bool isMirrorSurface(const std::unique_ptr<Material> &material) {
-		return (material->type == 1) || 
-			(((material->type == 3) || (material->type == 4) ) && (material->roughness < roughness_threshold));
+	bool isMirrorSurface(const Material &material) {
+		return (material.type == 1) || 
+			(((material.type == 3) || (material.type == 4) ) && (material.roughness < roughness_threshold));
 	}
 
 	class Vertex {
@@ -27,30 +30,61 @@ namespace rtt {
 			glm::vec3 position;
 			glm::vec2 p;
 			glm::vec3 throughput;
+			Vertex() = default;
 			Vertex(glm::vec3 wo, glm::vec3 position, glm::vec2 p, glm::vec3 throughput) : wo(wo), position(position), p(p), throughput(throughput) {}
 	};
 
-	void splatPPGSample (const int maxdepth, glm::vec3 intersectionNormal, std::vector<Vertex> vertices, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, std::mutex &) {
-		for (int i = 0; i < maxdepth - 1; i++) {
+	// path vertices kept for the PPG splats live on the stack, longer paths are not splatted beyond this length
+	const int maxPathLength = 32;
+	using PathVertices = std::array<Vertex, maxPathLength>;
+
+	void splatPPGSample (const int maxdepth, glm::vec3 intersectionNormal, const PathVertices &vertices, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree) {
+		for (int i = 0; i < std::min(maxdepth, maxPathLength) - 1; i++) {
 			if (vertices[i].wo != glm::vec3(0.f) && vertices[i+1].wo != glm::vec3(0.f) && vertices[i].throughput != glm::vec3(0.f) && intersectionNormal != glm::vec3(0.f)) {
 				glm::vec3 radiance = intersectionNormal * vertices[i].throughput;
-				//mtx.lock();
 				binaryTree->splatPosition(vertices[i].position, vertices[i].wo, img, 640, vertices[i].p, radiance);
-				//mtx.unlock();
 			}
 		}
 	}
 
-	float mis_balance(float pdf1, float pdf2) {
-		return pdf1 / (pdf1 + pdf2);
+	// first-hit features guiding the denoiser
+	class FeatureSample {
+		public:
+			glm::vec3 normal;
+			glm::vec3 albedo;
+			float depth;
+			FeatureSample() : normal(0.f), albedo(0.f), depth(0.f) {}
+	};
+
+	template<class M>
+	void recordFeatures(FeatureSample &features, const Intersection &its, const M &material) {
+		if (its.intersection) {
+			features.normal = its.normal;
+			features.albedo = material.albedo();
+			features.depth = its.distance;
+		} else {
+			features.normal = glm::vec3(0.f);
+			features.albedo = its.normal; // envmap radiance of the missed ray
+			features.depth = 0.f;
+		}
 	}
 
-	template<bool bsdf, bool nee>
-	glm::vec3 Li(const std::unique_ptr<BVH>&, const Ray &, const EnvMap &, Sampler &, const int, const std::unique_ptr<Material> &, std::vector<std::vector<glm::vec3>> &, std::unique_ptr<BinaryTree> &, bool, std::mutex &){}
+	// Russian roulette from bounce rouletteDepth on (0 disables it): the path survives with a probability following its
+	// throughput, which is divided by it so that the estimate stays unbiased. Returns false if the path is terminated.
+	bool russianRoulette(glm::vec3 &throughput, Sampler &sampler, const int depth, const int rouletteDepth) {
+		if (rouletteDepth <= 0 || depth < rouletteDepth) return true;
+		const float survival = std::min(0.95f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+		if (survival <= 0.f || sampler.next1D() >= survival) return false;
+		throughput /= survival;
+		return true;
+	}
 
+	float mis_balance(float pdf1, float pdf2) {
+		return pdf1 / (pdf1 + pdf2);
+	}
 
-	template<>
-	glm::vec3 Li<true, false>(const std::unique_ptr<BVH>& bvh, const Ray &ray, const EnvMap &envmap, Sampler &sampler, const int maxdepth, const std::unique_ptr<Material> &material, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, bool ppg, std::mutex &mtx)
+	template<class M>
+	glm::vec3 Li_BSDF(const std::unique_ptr<BVH>& bvh, const Ray &ray, const EnvMap &envmap, Sampler &sampler, const int maxdepth, const int rouletteDepth, const M &material, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, bool ppg, FeatureSample *features)
 	{
 		glm::vec3 throughput(1.f);
 		glm::vec3 color(0.f); // needed for mis later
@@ -60,7 +94,8 @@ namespace rtt {
 		bool inside = false;
 
 		// Required for PPG -- otherwise not used
-		std::vector<Vertex> vertices(maxdepth, Vertex(glm::vec3(0.f), glm::vec3(0.f), glm::vec2(0.f), glm::vec3(0.f)));	
+		PathVertices vertices; // no allocation per sample, only initialized for PPG
+		if (ppg) vertices.fill(Vertex(glm::vec3(0.f), glm::vec3(0.f), glm::vec2(0.f), glm::vec3(0.f)));
 		float wo_pdf = 1.f;
 		glm::vec2 p(0.f);	
 
@@ -70,9 +105,11 @@ namespace rtt {
 			Intersection its;
 			its.normal = envmap.direction_to_texture_coords(r.direction);
 
+			RTT_COUNT_RAY(depth == 1 ? Ray_Primary : Ray_Bounce);
 			bvh->intersect(its, r);
+			if (depth == 1 && features != nullptr) recordFeatures(*features, its, material);
 			if (its.intersection) {
-				if (material->type == 0) return abs(its.normal); // material_type = 0 --> normals
+				if constexpr (std::is_same_v<M, Material_normal>) return abs(its.normal); // material_type = 0 --> normals
 
 				Plane plane(its.normal);
 				glm::vec3 wi = plane.toLocal(-r.direction);
@@ -83,16 +120,17 @@ namespace rtt {
 				}
 				glm::vec3 local_wo = plane.toLocal(wo);
 				BSDF b(wi, std::ref(local_wo), std::ref(inside), wo_pdf);
-				const glm::vec3 bsdf = material->sample(std::ref(b), std::ref(sampler), ppg); // bsdf * cos / pdf
+				const glm::vec3 bsdf = material.sample(std::ref(b), std::ref(sampler), ppg); // bsdf * cos / pdf
 
 				r = Ray(its.position, plane.toGlobal(b.wo));
 				throughput *= bsdf;
 				inside = b.inside; // needed for conductors
+				if (!russianRoulette(throughput, sampler, depth, rouletteDepth)) return color;
 
-				if (ppg) vertices[depth - 1] = Vertex(wo, its.position, p, throughput);
+				if (ppg && depth <= maxPathLength) vertices[depth - 1] = Vertex(wo, its.position, p, throughput);
 
 			} else {
-				if (ppg) splatPPGSample(maxdepth, its.normal, vertices, img, binaryTree, mtx);
+				if (ppg) splatPPGSample(maxdepth, its.normal, vertices, img, binaryTree);
 
 				// no intersection ----> get the value of the environment map
 				if (inside) return color; // if the last bounce is refraction do not evaluate the envmap
@@ -104,8 +142,8 @@ namespace rtt {
 		return color;
 	}
 
-	template<>
-	glm::vec3 Li<false, true>(const std::unique_ptr<BVH>& bvh, const Ray &ray, const EnvMap &envmap, Sampler &sampler, const int maxdepth, const std::unique_ptr<Material> &material, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, bool ppg, std::mutex &mtx)
+	template<class M>
+	glm::vec3 Li_NEE(const std::unique_ptr<BVH>& bvh, const Ray &ray, const EnvMap &envmap, Sampler &sampler, const int maxdepth, const int rouletteDepth, const M &material, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, bool ppg, FeatureSample *features)
 	{
 		glm::vec3 throughput(1.f);
 		glm::vec3 color(0.f); // needed for mis later
@@ -113,9 +151,11 @@ namespace rtt {
 
 		Ray r = ray;
 		bool inside = false;
+		const bool isMirror = isMirrorSurface(material); // perfect mirror
 
 		// Required for PPG -- otherwise not used
-		std::vector<Vertex> vertices(maxdepth, Vertex(glm::vec3(0.f), glm::vec3(0.f), glm::vec2(0.f), glm::vec3(0.f)));	
+		PathVertices vertices; // no allocation per sample, only initialized for PPG
+		if (ppg) vertices.fill(Vertex(glm::vec3(0.f), glm::vec3(0.f), glm::vec2(0.f), glm::vec3(0.f)));
 		float wo_pdf = 1.f;
 		glm::vec2 p(0.f);
 
@@ -124,11 +164,12 @@ namespace rtt {
 
 			Intersection its;
 			its.normal = envmap.direction_to_texture_coords(r.direction);
-			bool isMirror = isMirrorSurface(material); // perfect mirror
 
+			RTT_COUNT_RAY(depth == 1 ? Ray_Primary : Ray_Bounce);
 			bvh->intersect(its, r);
+			if (depth == 1 && features != nullptr) recordFeatures(*features, its, material);
 			if (its.intersection) {
-				if (material->type == 0) return abs(its.normal); // material_type = 0 --> normals
+				if constexpr (std::is_same_v<M, Material_normal>) return abs(its.normal); // material_type = 0 --> normals
 
 				Plane plane(its.normal);
 				glm::vec3 wi = plane.toLocal(-r.direction);
@@ -142,11 +183,12 @@ namespace rtt {
 				its_envmap.normal = envmap.direction_to_texture_coords(r.direction);
 				Ray r_nee(its.position, plane.toGlobal(d));
 
+				RTT_COUNT_RAY(Ray_Shadow);
 				bvh->intersect(its_envmap, r_nee);
 				BSDF b_nee(wi, std::ref(d), std::ref(inside), wo_pdf);
 				if (!its_envmap.intersection && !b_nee.inside && !isMirror) { // check if envmap is occluded
-					const glm::vec3 bsdf_nee = material->sample(std::ref(b_nee), std::ref(sampler), false);
-					color += bsdf_nee * Li_nee; // without throughput as it is always 1 and is therefore used for bsdf ppg
+					const glm::vec3 bsdf_nee = material.sample(std::ref(b_nee), std::ref(sampler), false);
+					color += throughput * bsdf_nee * Li_nee; // the throughput carries the 1 / survival of the roulette
 				}
 
 				if (ppg) {
@@ -156,18 +198,19 @@ namespace rtt {
 				glm::vec3 local_wo = plane.toLocal(wo);
 				BSDF b(wi, std::ref(local_wo), std::ref(inside), wo_pdf);
 
-				const glm::vec3 bsdf = material->sample(std::ref(b), std::ref(sampler), ppg); // bsdf * cos / pdf
+				const glm::vec3 bsdf = material.sample(std::ref(b), std::ref(sampler), ppg); // bsdf * cos / pdf
 				throughput *= bsdf;
 
 				r = Ray(its.position, plane.toGlobal(b.wo));
 				inside = b.inside; // needed for conductors
+				if (!russianRoulette(throughput, sampler, depth, rouletteDepth)) return color;
 
-				if (ppg) vertices[depth - 1] = Vertex(wo, its.position, p, throughput);
+				if (ppg && depth <= maxPathLength) vertices[depth - 1] = Vertex(wo, its.position, p, throughput);
 
 			} else if (depth == 1) {
-				return its.normal; // * throughput = 1.f;
+				return its.normal * throughput;
 			} else {
-				if (ppg) splatPPGSample(maxdepth, its.normal, vertices, img, binaryTree, mtx);
+				if (ppg) splatPPGSample(maxdepth, its.normal, vertices, img, binaryTree);
 
 				if (inside || isMirror) return color;
 
@@ -178,8 +221,8 @@ namespace rtt {
 		return color;
 	}
 
-	template<>
-	glm::vec3 Li<true, true>(const std::unique_ptr<BVH>& bvh, const Ray &ray, const EnvMap &envmap, Sampler &sampler, const int maxdepth, const std::unique_ptr<Material> &material, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, bool ppg, std::mutex &mtx)
+	template<class M>
+	glm::vec3 Li_MIS(const std::unique_ptr<BVH>& bvh, const Ray &ray, const EnvMap &envmap, Sampler &sampler, const int maxdepth, const int rouletteDepth, const M &material, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, bool ppg, FeatureSample *features)
 	{
 		glm::vec3 throughput(1.f);
 		glm::vec3 color(0.f); // needed for mis later
@@ -187,12 +230,14 @@ namespace rtt {
 
 		Ray r = ray;
 		bool inside = false;
+		const bool isMirror = isMirrorSurface(material); // perfect mirror
 
 		// MIS variables
 		float bsdf_pdf = 1.f;
 
 		// Required for PPG -- otherwise not used
-		std::vector<Vertex> vertices(maxdepth, Vertex(glm::vec3(0.f), glm::vec3(0.f), glm::vec2(0.f), glm::vec3(0.f)));	
+		PathVertices vertices; // no allocation per sample, only initialized for PPG
+		if (ppg) vertices.fill(Vertex(glm::vec3(0.f), glm::vec3(0.f), glm::vec2(0.f), glm::vec3(0.f)));
 		float wo_pdf = 1.f;
 		glm::vec2 p(0.f);
 
@@ -201,12 +246,13 @@ namespace rtt {
 
 			Intersection its;
 			its.normal = envmap.direction_to_texture_coords(r.direction);
-			bool isMirror = isMirrorSurface(material); // perfect mirror
 
+			RTT_COUNT_RAY(depth == 1 ? Ray_Primary : Ray_Bounce);
 			bvh->intersect(its, r);
+			if (depth == 1 && features != nullptr) recordFeatures(*features, its, material);
 			Plane plane(its.normal);
 			if (its.intersection) {
-				if (material->type == 0) return abs(its.normal); // material_type = 0 --> normals
+				if constexpr (std::is_same_v<M, Material_normal>) return abs(its.normal); // material_type = 0 --> normals
 
 				glm::vec3 wi = plane.toLocal(-r.direction);
 				glm::vec3 wo = wi;
@@ -219,12 +265,13 @@ namespace rtt {
 				Intersection its_envmap;
 				Ray r_nee(its.position, plane.toGlobal(d));
 
+				RTT_COUNT_RAY(Ray_Shadow);
 				bvh->intersect(its_envmap, r_nee);
 				BSDF b_nee(wi, std::ref(d), std::ref(inside), wo_pdf);
 				if (!its_envmap.intersection && d.z >= 0.f && !b_nee.inside && !isMirror) { // check if envmap is occluded
-					const glm::vec3 bsdf_nee = material->evaluate(std::ref(b_nee));
+					const glm::vec3 bsdf_nee = material.evaluate(std::ref(b_nee));
 
-					float bsdf_pdf = material->pdf(b_nee);
+					float bsdf_pdf = material.pdf(b_nee);
 					color += throughput * bsdf_nee * Li_nee * d.z * mis_balance(envmapPDF, bsdf_pdf);
 				}
 
@@ -234,18 +281,19 @@ namespace rtt {
 
 				glm::vec3 local_wo = plane.toLocal(wo);
 				BSDF b(wi, std::ref(local_wo), std::ref(inside), wo_pdf);
-				const glm::vec3 bsdf = material->sample(std::ref(b), std::ref(sampler), ppg); // bsdf * cos / pdf
+				const glm::vec3 bsdf = material.sample(std::ref(b), std::ref(sampler), ppg); // bsdf * cos / pdf
 
 				r = Ray(its.position, plane.toGlobal(b.wo));
 
-				bsdf_pdf = material->pdf(b);
+				bsdf_pdf = material.pdf(b);
 				throughput *= bsdf;
 				inside = b.inside; // needed for conductors
+				if (!russianRoulette(throughput, sampler, depth, rouletteDepth)) return color;
 
-				if (ppg) vertices[depth - 1] = Vertex(wo, its.position, p, throughput);
+				if (ppg && depth <= maxPathLength) vertices[depth - 1] = Vertex(wo, its.position, p, throughput);
 
 			} else {
-				if (ppg) splatPPGSample(maxdepth, its.normal, vertices, img, binaryTree, mtx);
+				if (ppg) splatPPGSample(maxdepth, its.normal, vertices, img, binaryTree);
 
 				if (inside || isMirror) return color;
 
@@ -257,4 +305,23 @@ namespace rtt {
 
 		return color;
 	}
+
+	// the path construction technique and the concrete material type are both resolved at compile time
+	template<bool bsdf, bool nee, class M>
+	glm::vec3 Li(const std::unique_ptr<BVH>& bvh, const Ray &ray, const EnvMap &envmap, Sampler &sampler, const int maxdepth, const int rouletteDepth, const M &material, std::vector<std::vector<glm::vec3>> &img, std::unique_ptr<BinaryTree> &binaryTree, bool ppg, FeatureSample *features)
+	{
+		if constexpr (bsdf && nee) return Li_MIS(bvh, ray, envmap, sampler, maxdepth, rouletteDepth, material, img, binaryTree, ppg, features);
+		else if constexpr (nee) return Li_NEE(bvh, ray, envmap, sampler, maxdepth, rouletteDepth, material, img, binaryTree, ppg, features);
+		else return Li_BSDF(bvh, ray, envmap, sampler, maxdepth, rouletteDepth, material, img, binaryTree, ppg, features);
+	}
+
+	// calls function with the material cast to its concrete type, so that the BSDF calls of the frame can be inlined
+	template<class Function>
+	auto visitMaterial(const Material &material, Function &&function) {
+		if (auto m = dynamic_cast<const Material_diffuse*>(&material)) return function(*m);
+		if (auto m = dynamic_cast<const Material_conductor*>(&material)) return function(*m);
+		if (auto m = dynamic_cast<const Material_dielectric*>(&material)) return function(*m);
+		if (auto m = dynamic_cast<const Material_mirror*>(&material)) return function(*m);
+		return function(dynamic_cast<const Material_normal&>(material));
+	}
 }
@@ -1,237 +1,173 @@
 #pragma once
 #include <fstream> //save image
-#include <string.h> 
 #include <memory>
+#include <vector>
+#include <algorithm>
 #include <atomic>         // std::atomic, std::atomic_flag, ATOMIC_FLAG_INIT
 
 #include "sampler.h"
+#include "trace.h"
 
 float flux_threshold = 0.01f;
+const int maxQuadTreeLevel = 20; // refinement stops here even for a single bright direction
 
-class Point {
-	public:
-		float x;
-		float y;
-		Point(float x, float y) : x(x), y(y) {}
-
-		bool operator<= (Point p) {
-			return x <= p.x && y <= p.y;
-		}
-
-		bool operator> (Point p) {
-			return x > p.x && y > p.y;
-		}
-};
-
-class BBox {
-	public:
-		Point a; // upper left point
-		Point b; // lower right point
-		float length; // side of the square
-		BBox(Point a, Point b) : a(a), b(b), length(b.x - a.x) {}
-
-		std::vector<BBox> splitBBox() { // i: 0 - upper left, 1 - upper right, 2 - lower left, 3 - lower right
-			float halfLength = length / 2.f;
-			std::vector<BBox> bboxes;
-			bboxes.push_back(BBox(a, Point(a.x + halfLength, a.y + halfLength)));
-			bboxes.push_back(BBox(Point(a.x + halfLength, a.y), Point(b.x, a.y + halfLength)));
-			bboxes.push_back(BBox(Point(a.x, a.y + halfLength), Point(a.x + halfLength, b.y)));
-			bboxes.push_back(BBox(Point(a.x + halfLength, a.y + halfLength), b));
-			return bboxes;
-		}
-
-		bool containsPoint(Point p) {
-			return a <= p && b > p;
-		}	
-};
+// lock-free float accumulation, std::atomic<float> has no fetch_add before C++20
+void atomicAdd(std::atomic<float> &value, float add) {
+	float old = value.load(std::memory_order_relaxed);
+	while (!value.compare_exchange_weak(old, old + add, std::memory_order_relaxed));
+}
 
-class DNode {
+// one inner node of the directional quadtree, for its four quadrants: 0 - upper left, 1 - upper right, 2 - lower left,
+// 3 - lower right. A quadrant without a child node (index 0, the root is never a child) is a leaf.
+class QuadNode {
 	public:
-		std::vector<DNode> children; // 4 or 0 children inside 1 Node
-		std::atomic<float> flux; // sum of childrens' fluxes
-		int level;
-		BBox b;
-		DNode(std::atomic<float> flux, int level, BBox b) : flux(flux.load()), level(level), b(b) {}
-		DNode(const DNode &dn) : children(dn.children), flux(std::atomic<float>(dn.flux.load())), level(dn.level), b(dn.b) {} // copy constructor
-
-		void mergeDNode() {
-			if (!isLeaf()) {
-				for (int i = 0; i < 4; i++) {
-					children[i].mergeDNode();
-				}
-				children.clear();
-			}
-		}
+		std::atomic<float> flux[4];
+		unsigned int child[4] = {0, 0, 0, 0};
+		QuadNode() { for (auto &f : flux) f.store(0.f, std::memory_order_relaxed); }
+		QuadNode(const QuadNode &node) { *this = node; }
 
-		DNode& operator=(const DNode &dn) {
-			if (this == &dn) return *this;
-			DNode n = dn; 
-			if (!n.isLeaf()) {
-				if (isLeaf()) {
-					for (int i = 0; i < 4; i ++) {
-						DNode c = n.children[i];
-						children.push_back(c);
-					}
-				}
-				for (int i = 0; i < 4; i ++) {
-					DNode c = n.children[i];
-					children[i]=(c);
-				}
-			} else {
-				mergeDNode();
-			}
-			flux.exchange(n.flux.load());
-			level = n.level;
-			b = n.b;
-			return *this;
-		}
-
-		bool isLeaf() {
-			return children.size() == 0;
-		}
-
-		void splitLeafNode() {
-			std::vector<BBox> bboxes = b.splitBBox();
-			if (children.size() != 0) std::cout << "[DEBUG] Tried to split node with " << children.size() << " children" << std::endl;
+		// not atomic as a whole, only while no splat runs (between iterations)
+		QuadNode& operator=(const QuadNode &node) {
 			for (int i = 0; i < 4; i++) {
-				DNode node(std::atomic<float>(flux.load() / 4.f), level+1, bboxes[i]);
-				children.push_back(node);
-			}
-		}
-
-		void recordDirection(Point p, float f) {
-			if (b.containsPoint(p)) {
-				flux.store(flux.load() + f);
-
-				if (!isLeaf()) {
-					if (children.size() != 4) std::cout << "[DEBUG] Tried to record direction of node with " << children.size() << " children" << std::endl;
-					for (unsigned int i = 0; i < children.size(); i++) {
-						children[i].recordDirection(p, f);
-					}
-				}
-			}
-		}
-
-		void refineQuadtree(float total_flux) {
-			if (flux.load() / total_flux <= flux_threshold) {
-				mergeDNode(); // merge this node childrens' nodes so that it is a leaf now
-			} else if (isLeaf()) {
-				splitLeafNode();
-			}
-			
-			if (!isLeaf()) {
-				if (children.size() != 4) std::cout << "[DEBUG] Tried to record direction of node with " << children.size() << " children" << std::endl;
-				for (unsigned int i = 0; i < children.size(); i++) {
-					//std::cout << total_flux << " " << flux.load() / total_flux << std::endl;
-					children[i].refineQuadtree(total_flux);
-				}
-			} 
-		}
-
-		Point sampleFromQuadTreeNode(Point randomPoint, Sampler &sampler, float &pdf_wo) {
-			if(isLeaf() || flux.load() <= 0.f) { // sample random position within the boundaries of the leaf node
-				float side = b.b.x - b.a.x;
-				pdf_wo *= 1.f / (4.f * M_PI);
-				return Point(randomPoint.x * side + b.a.x, randomPoint.y * side + b.a.y);
-			} else { //sample child by energy
-				const float r = sampler.next1D();
-				std::vector<float> cumSum(5, 0.f);
-				for (int i = 1; i < 5; i++) {
-					cumSum[i] = cumSum[i-1] + children[i-1].flux.load() / flux.load();
-					if (cumSum[i] >= r) {
-						float alpha = 4.f * (children[i-1].flux.load() / flux.load());
-						pdf_wo *= alpha;	
-						return children[i-1].sampleFromQuadTreeNode(randomPoint, sampler, pdf_wo);
-					}
-				}
-
-				// handle last child when floating point imprecision
-				float alpha = 4.f * (children[3].flux.load() / flux.load());
-				pdf_wo *= alpha;	
-				return children[3].sampleFromQuadTreeNode(randomPoint, sampler, pdf_wo);
-			}
-		}
-
-		void saveLeafNode(int side, std::vector<std::vector<float>> &image) {
-			if (isLeaf()) {
-				for (unsigned int i = b.a.x * side; i < b.b.x * side; ++i) { 
-					for (unsigned int j = b.a.y * side; j < b.b.y * side; ++j) { 
-						image[i][j] = flux.load();
-					}
-				}
-			} else {
-				if (children.size() != 4) std::cout << "[DEBUG] Tried to save leaf node with " << children.size() << " children" << std::endl;
-				for (int i = 0; i < 4; i++) {
-					children[i].saveLeafNode(side, image);
-				}
+				flux[i].store(node.flux[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+				child[i] = node.child[i];
 			}
+			return *this;
 		}
 };
 
+// Directional quadtree stored as a flat array of nodes, the root first. The topology is rebuilt once per iteration
+// (prepareNextIteration) and stays fixed meanwhile, so splats only add to the fluxes and may run concurrently.
 class QuadTree { // root
 	public:
-		std::atomic<float> flux{0.f};
-		DNode root;
-		QuadTree() : root(DNode(0.f, 0, BBox(Point(0.f,0.f), Point(1.f, 1.f)))) {} // initialize the quadtree
-		QuadTree(const QuadTree &q) : flux(std::atomic<float>(q.flux.load())), root(q.root) {} // copy the quadtree
-		QuadTree(float gui_t) : root(DNode(0.f, 0, BBox(Point(0.f,0.f), Point(1.f, 1.f)))) {flux_threshold = gui_t;} // initialize the quadtree
+		std::atomic<float> flux{0.f}; // sum of the root's fluxes
+		std::vector<QuadNode> nodes;
+		QuadTree() : nodes(1) {} // initialize the quadtree
+		QuadTree(float gui_t) : nodes(1) {flux_threshold = gui_t;} // initialize the quadtree
+		QuadTree(const QuadTree &q) : flux(q.flux.load()), nodes(q.nodes) {}
 
 		QuadTree& operator=(const QuadTree &q) {
 			if (this == &q) return *this; // handle self-assignment
-			flux.exchange(q.flux.load());
-			DNode r = q.root;
-			root =(r);
+			flux.store(q.flux.load());
+			nodes = q.nodes; // one pass over the array, no reallocation when the size is kept
 			return *this;
 		}
 
+		// safe to call from several threads, as long as nothing refines the tree meanwhile
 		void splatDirection (glm::vec2 point, glm::vec3 radiance) {
+			if (!(point.x >= 0.f && point.x < 1.f && point.y >= 0.f && point.y < 1.f)) return;
 			float irradiance = ((radiance[0] + radiance[1] + radiance[2]) / 3.f); //mean radiance
-			flux.store(flux.load() + irradiance);
+			atomicAdd(flux, irradiance);
 
-			root.recordDirection(Point(point.x, point.y), irradiance);
+			unsigned int index = 0;
+			do {
+				// point relative to the node, scaled to [0,1)
+				const int right = point.x >= 0.5f, lower = point.y >= 0.5f;
+				const int quadrant = right + 2 * lower;
+				point = 2.f * point - glm::vec2(right, lower);
+				QuadNode &node = nodes[index];
+				atomicAdd(node.flux[quadrant], irradiance);
+				index = node.child[quadrant];
+			} while (index != 0);
 		}
 
+		// new topology from the fluxes: quadrants above flux_threshold of the total are split, the others become leaves
 		void refineQuadTree() {
-			root.refineQuadtree(flux.load());
+			if (flux.load() <= 0.f) return;
+			std::vector<QuadNode> refined(1);
+			refineNode(0, 0, 0, refined);
+			nodes.swap(refined);
 		}
 
+		// between two iterations: the nodes are split and merged following the flux splatted in the last one, which is then
+		// cleared. The next iteration splats into this topology without modifying it.
+		void prepareNextIteration() {
+			refineQuadTree();
+			for (auto &node : nodes)
+				for (auto &f : node.flux) f.store(0.f, std::memory_order_relaxed);
+			flux.store(0.f);
+		}
+
+		// descends by flux to a leaf and samples it uniformly, no allocation
 		glm::vec2 sampleFromQuadTree(glm::vec2 randomPoint, Sampler &sampler, float &pdf_wo) {
-			Point p = root.sampleFromQuadTreeNode(Point(randomPoint.x, randomPoint.y), sampler, pdf_wo);
-			return glm::vec2{p.x, p.y};
+			glm::vec2 origin(0.f);
+			float side = 1.f;
+			unsigned int index = 0;
+			do {
+				const QuadNode &node = nodes[index];
+				float f[4];
+				for (int i = 0; i < 4; i++) f[i] = node.flux[i].load(std::memory_order_relaxed); // read-only during an iteration
+				const float c1 = f[0], c2 = c1 + f[1], c3 = c2 + f[2], total = c3 + f[3];
+				if (!(total > 0.f)) break; // nothing recorded here, uniform within the node
+				const float r = sampler.next1D() * total;
+				const int quadrant = (r >= c1) + (r >= c2) + (r >= c3);
+				pdf_wo *= 4.f * f[quadrant] / total;
+				side *= 0.5f;
+				origin += side * glm::vec2(quadrant & 1, quadrant >> 1);
+				index = node.child[quadrant];
+			} while (index != 0);
+
+			pdf_wo *= 1.f / (4.f * M_PI);
+			return origin + side * randomPoint;
 		}
-		
+
 		void reset() {
-			if(root.isLeaf()) { 
-				flux.store(0.f);
-				root.flux.store(0.f);
-			} else {
-				flux.store(0.f);
-				root.mergeDNode();
-				root.flux.store(0.f);
-				root.level = 0;
-				root.b = BBox(Point(0.f, 0.f), Point(1.f,1.f));
-			}
-			
+			flux.store(0.f);
+			nodes.assign(1, QuadNode());
 		}
 
 		void saveQuadtreeImage(int side, int ind, int quadNumber) { // side = 640
+			RTT_TRACE_SCOPE("quadtree dump", quadNumber);
 			std::string imageName = "images/quadtree_" + std::to_string(ind) + "_" + std::to_string(quadNumber) + ".ppm";
 			std::ofstream outfile (imageName, std::ios::out | std::ios::binary);  
 			outfile << "P6\n" << side << " " << side << "\n255\n";
 			int scale = (int) (1.f / flux_threshold);
+			const float total = flux.load();
 			
 			std::vector<std::vector<float>> image(side, std::vector<float>(side, 0.f)); 
-			root.saveLeafNode(side, std::ref(image));
+			saveLeafNodes(0, 0.f, 0.f, 1.f, side, image);
 			for (int i = 0; i < side; ++i) { 
 				for (int j = 0; j < side; ++j) { 
 					//std::cout << (image[i][j] * 100) / (float) flux << " : " << ind << " : " << flux << std::endl;
-					outfile << (unsigned char)(std::min(1.f, (image[i][j] * scale) / (float) flux.load()) * 255) // [0,0.01) --> [0,1) make it visible
-						<< (unsigned char)(std::min(1.f, (image[i][j] * scale) / (float) flux.load()) * 255)
-						<< (unsigned char)(std::min(1.f, (image[i][j] * scale) / (float) flux.load()) * 255);
+					outfile << (unsigned char)(std::min(1.f, (image[i][j] * scale) / total) * 255) // [0,0.01) --> [0,1) make it visible
+						<< (unsigned char)(std::min(1.f, (image[i][j] * scale) / total) * 255)
+						<< (unsigned char)(std::min(1.f, (image[i][j] * scale) / total) * 255);
 				} 
 			}			
 		 
 			outfile.close();
 			image.clear();
 		}
+
+	private:
+		// rebuilds node old of this tree (-1: a new split, whose fluxes are already in refined[target]) into refined[target]
+		void refineNode(int old, unsigned int target, int level, std::vector<QuadNode> &refined) {
+			for (int i = 0; i < 4; i++) {
+				const float f = old >= 0 ? nodes[old].flux[i].load() : refined[target].flux[i].load();
+				refined[target].flux[i].store(f);
+				if (f / flux.load() <= flux_threshold || level + 1 >= maxQuadTreeLevel) continue; // leaf, merging its subtree if any
+				refined.emplace_back();
+				const unsigned int child = refined.size() - 1;
+				refined[target].child[i] = child;
+				const int oldChild = old >= 0 && nodes[old].child[i] != 0 ? (int) nodes[old].child[i] : -1;
+				if (oldChild < 0) for (auto &childFlux : refined[child].flux) childFlux.store(f / 4.f); // split leaf
+				refineNode(oldChild, child, level + 1, refined);
+			}
+		}
+
+		void saveLeafNodes(unsigned int index, float x, float y, float size, int side, std::vector<std::vector<float>> &image) {
+			const float half = size / 2.f;
+			for (int q = 0; q < 4; q++) {
+				const float qx = x + half * (q & 1), qy = y + half * (q >> 1);
+				if (nodes[index].child[q] != 0) {
+					saveLeafNodes(nodes[index].child[q], qx, qy, half, side, image);
+					continue;
+				}
+				for (unsigned int i = qx * side; i < (qx + half) * side; ++i) { 
+					for (unsigned int j = qy * side; j < (qy + half) * side; ++j) { 
+						image[i][j] = nodes[index].flux[q].load();
+					}
+				}
+			}
+		}
 };
@@ -4,7 +4,6 @@
 #include <vector>
 #include <chrono>
 #include <memory>
-#include <mutex>
 
 #include <glm/glm.hpp>
 
@@ -15,32 +14,31 @@
 #include "bvh.h"
 #include "envmap.h"
 #include "pathtracer.h"
+#include "streamtracer.h"
+#include "threadpool.h"
+#include "tile.h"
+#include "film.h"
+#include "denoiser.h"
+#include "cancel.h"
+#include "parameters.h"
+#include "imageio.h"
+#include "instrument.h"
+#include "trace.h"
 #include "materials/material.h"
 
-#include "omp.h"
-
 
 namespace rtt //Realistic Ray Tracer
 {
-	std::mutex mtx;
-
 	void saveimg(std::vector<std::vector<glm::vec3>>& img, int side, int p) {
+		RTT_TRACE_SCOPE("ppg splat image", p);
 		std::string imgName = "images/quadEnvmap" + to_string(p) + ".ppm";
-		std::ofstream outfile (imgName, std::ios::out | std::ios::binary);  
-		outfile << "P6\n" << side << " " << side << "\n255\n"; 
-		
-		for (int i = 0; i < side; ++i) { 
-			for (int j = 0; j < side; ++j) { 
-				outfile << (unsigned char)(std::min(1.f, img[i][j][0]) * 255)
-					<< (unsigned char)(std::min(1.f, img[i][j][1]) * 255)
-					<< (unsigned char)(std::min(1.f, img[i][j][2]) * 255);
-			} 
-		}
-	 
-		outfile.close();
+		std::vector<glm::vec3> image;
+		image.reserve(side * side);
+		for (const auto &row : img) image.insert(image.end(), row.begin(), row.begin() + side);
+		writePPM(imgName, image, side, side);
 	}
 
-	void getMaterial(GUI& gui, std::unique_ptr<Material> &material) {
+	void getMaterial(const GUI& gui, std::unique_ptr<Material> &material) {
 		switch (gui.curr_material) {
 			case 0:
 				material = std::make_unique<Material_normal>();
@@ -63,14 +61,14 @@ namespace rtt //Realistic Ray Tracer
 			}
 			case 3: 
 			{
-				material = std::make_unique<Material_dielectric>(gui.roughness, gui.refIndex);
+				material = std::make_unique<Material_dielectric>(gui.roughness, gui.refIndex, gui.exactFresnel);
 				material->type = gui.curr_material;
 				material->roughness = gui.roughness;
 				break;
 			}
 			case 4: 
 			{
-				material = std::make_unique<Material_conductor>(gui.roughness, gui.getMetalEta(gui.curr_metal), gui.getMetalKappa(gui.curr_metal));
+				material = std::make_unique<Material_conductor>(gui.roughness, gui.getMetalEta(gui.curr_metal), gui.getMetalKappa(gui.curr_metal), gui.exactFresnel);
 				material->type = gui.curr_material;
 				material->roughness = gui.roughness;
 				break;
@@ -82,127 +80,290 @@ namespace rtt //Realistic Ray Tracer
 			}
 	}
 
+	// the materials of the scene file, each one made like the GUI material it corresponds to
+	void getSceneMaterials(const std::vector<MaterialDescription> &descriptions, MaterialTable &materials) {
+		materials.clear();
+		for (const auto &description : descriptions) {
+			GUI settings;
+			settings.curr_material = description.type;
+			settings.roughness = description.roughness;
+			settings.diffColor = description.color;
+			settings.refIndex = description.ior;
+			settings.curr_metal = description.metal;
+			materials.emplace_back();
+			getMaterial(settings, materials.back());
+		}
+	}
+
+	// Writes the average of spp samples per pixel into buffer, or, given a film, adds spp samples to its active pixels
+	// (continuing the sample index of every pixel). Returns false if the frame was cancelled: cancellation is checked
+	// per pixel, so the tiles that were in progress may be partially written, and the tiles not started are left untouched.
+	// Given a region only its pixels are rendered (distributed rendering), the buffer still covers the whole image.
 	template<bool bsdf, bool nee, bool ppg>
-	void renderNextFrame(const std::unique_ptr<BVH>& bvh, std::vector<glm::vec3> &buffer, unsigned int width, unsigned int height, rtt::Camera &camera, EnvMap& envmap, const int spp, Sampler &sampler, const int depth, const std::unique_ptr<Material> &material, std::unique_ptr<BinaryTree> &binaryTree, int iterationNumber) 
+	bool renderNextFrame(const std::unique_ptr<BVH>& bvh, std::vector<glm::vec3> &buffer, unsigned int width, unsigned int height, rtt::Camera &camera, EnvMap& envmap, const int spp, Sampler &sampler, const int depth, const int rouletteDepth, const std::unique_ptr<Material> &material, std::unique_ptr<BinaryTree> &binaryTree, int iterationNumber, unsigned int firstSample = 0, const CancelToken *cancel = nullptr, Film *film = nullptr, const Tile *region = nullptr) 
 	{
+		RTT_TRACE_SCOPE("render pass", spp);
 		float screenWidthDiv  = camera.screenWidthDiv;
 		float screenHeightDiv = camera.screenHeightDiv;
 		float pixelX		  = camera.pixelX;
 		float pixelY	      = camera.pixelY;
-		std::vector<std::vector<glm::vec3>> img(width, std::vector<glm::vec3>(width, glm::vec3(0.f)));
+		// debug image of the PPG splats, allocated by the first PPG frame and reused by the next ones
+		static std::vector<std::vector<glm::vec3>> img;
+		if constexpr(ppg) if (img.size() != width) img.assign(width, std::vector<glm::vec3>(width, glm::vec3(0.f)));
 
-		#pragma omp parallel
-		{
-			glm::vec3 color(0.f);
-			#pragma omp for schedule(dynamic)
-			for (unsigned int y = 0; y < height; y++) 
-			{ 
-				for (unsigned int x = 0; x < width; x++) 
+		const auto cancelled = [cancel]() { return cancel != nullptr && cancel->isCancelled(); };
+
+		const std::vector<Tile> tiles = region != nullptr ? createTiles(*region) : createTiles(width, height);
+#ifdef RTT_INSTRUMENT
+		if (pixelCosts.traversal.size() != width * height) pixelCosts.reset(width * height);
+#endif
+		// the material type is resolved once per frame, so that Li is compiled for each concrete material
+		visitMaterial(*material, [&](const auto &concreteMaterial) {
+			threadPool().parallelFor(tiles.size(), [&](unsigned int t, unsigned int) {
+				RTT_TRACE_SCOPE("tile", t);
+				const Tile &tile = tiles[t];
+				Sampler pixelSampler(sampler.seed, sampler.type); // restarted for every pixel sample
+				for (unsigned int y = tile.y0; y < tile.y1; y++)
 				{
-					for (int i = 0; i < spp; i++) { // for each pixel shoot many rays (spp) TODO: use parallel for loarge numbers
-						float u = screenHeightDiv - pixelY * (sampler.next1D() + (float)y);
-						float v = screenWidthDiv  + pixelX * (sampler.next1D() + (float)x);
-						const Ray ray(camera.origin, camera.computeDirection(u, v));
-						if constexpr(ppg) mtx.lock();
-						color += Li<bsdf, nee>(bvh, ray, envmap, sampler, depth, material, img, binaryTree, ppg, std::ref(mtx));
-						if constexpr(ppg) mtx.unlock();
+					for (unsigned int x = tile.x0; x < tile.x1; x++)
+					{
+						if (cancelled()) return;
+						const unsigned int pixel = width * y + x;
+						unsigned int first = firstSample;
+						if (film != nullptr) {
+							if (!film->active[pixel]) continue;
+							first = film->pixelSamples[pixel];
+						}
+
+#ifdef RTT_INSTRUMENT
+						const unsigned long costBefore = threadCounters().cost();
+						const auto pixelStart = std::chrono::steady_clock::now();
+#endif
+						glm::vec3 color(0.f);
+						float luminanceSq = 0.f;
+						FeatureSample features, featureSum;
+						for (int i = 0; i < spp; i++) { // for each pixel shoot many rays (spp)
+							pixelSampler.startPixelSample(pixel, first + i);
+							const glm::vec2 jitter = pixelSampler.next2D();
+							float u = screenHeightDiv - pixelY * (jitter.y + (float)y);
+							float v = screenWidthDiv  + pixelX * (jitter.x + (float)x);
+							const Ray ray(camera.origin, camera.computeDirection(u, v));
+							const glm::vec3 L = Li<bsdf, nee>(bvh, ray, envmap, pixelSampler, depth, rouletteDepth, concreteMaterial, img, binaryTree, ppg, film != nullptr ? &features : nullptr);
+							color += L;
+							luminanceSq += Film::luminance(L) * Film::luminance(L);
+							featureSum.normal += features.normal;
+							featureSum.albedo += features.albedo;
+							featureSum.depth  += features.depth;
+						}
+#ifdef RTT_INSTRUMENT
+						pixelCosts.traversal[pixel] += threadCounters().cost() - costBefore;
+						pixelCosts.seconds[pixel] += std::chrono::duration<float>(std::chrono::steady_clock::now() - pixelStart).count();
+#endif
+						if (film != nullptr) {
+							film->addSamples(pixel, color, luminanceSq, spp);
+							film->addFeatures(pixel, featureSum.normal, featureSum.albedo, featureSum.depth);
+						} else {
+							buffer[pixel] = color / (float) spp;
+						}
 					}
-					buffer[width * y + x] = color / (float) spp;
-					color = glm::vec3(0.f);
 				}
-			}
-		}
+			});
+		});
 		if constexpr(ppg)
 		{
-			mtx.lock();
 			saveimg(img, width, iterationNumber);
-			img = std::vector<std::vector<glm::vec3>>(width, std::vector<glm::vec3>(width, glm::vec3(0.f)));
-			mtx.unlock();
+			for (auto &row : img) std::fill(row.begin(), row.end(), glm::vec3(0.f));
 		}
+		return !cancelled();
 	}
 
+	// a cancelled iteration is dropped and the guiding structures are reset
 	template<bool bsdf, bool nee>
-	void renderNextFrame_PPG(const std::unique_ptr<BVH>& bvh, std::vector<glm::vec3> &buffer, std::vector<glm::vec3> &image, unsigned int width, unsigned int height, rtt::Camera &camera, EnvMap& envmap, const int spp, Sampler &sampler, const int depth, const std::unique_ptr<Material> &material, std::unique_ptr<BinaryTree> &binaryTree, int iterationNumber) 
+	bool renderNextFrame_PPG(const std::unique_ptr<BVH>& bvh, FrameExchange &frames, unsigned int width, unsigned int height, rtt::Camera &camera, EnvMap& envmap, const int spp, Sampler &sampler, const int depth, const int rouletteDepth, const std::unique_ptr<Material> &material, std::unique_ptr<BinaryTree> &binaryTree, int iterationNumber, const CancelToken *cancel = nullptr) 
 	{
+		bool completed = true;
 		for (int p = 0; p <= iterationNumber; p++) {
+			RTT_TRACE_SCOPE("ppg iteration", p);
 			cout << "PPG ..............................................." << p << endl;
 			const int spps = pow(2, p); (void) spp;
-			buffer = std::vector<glm::vec3>(width*height, glm::vec3(0.f)); // empty buffer in each iteration
+			std::vector<glm::vec3> &buffer = frames.backBuffer();
+			std::fill(buffer.begin(), buffer.end(), glm::vec3(0.f)); // empty buffer in each iteration
 
-			renderNextFrame<bsdf, nee, true>(bvh, buffer, width, height, camera, envmap, spps, sampler, depth, std::ref(material), binaryTree, p);
+			// iteration p renders the samples [2^p, 2^(p+1)) so that every iteration is a complete Sobol block
+			completed = renderNextFrame<bsdf, nee, true>(bvh, buffer, width, height, camera, envmap, spps, sampler, depth, rouletteDepth, std::ref(material), binaryTree, p, spps, cancel);
+			if (!completed) break;
 
-			std::swap(image, buffer);
+			frames.publish();
 
-			mtx.lock(); // any synchronization needed here if multiple threads
-			binaryTree->resetQuadTree(width, p);
-			binaryTree->refine(p);
-			mtx.unlock();
+			// the render threads are done with the iteration: the sampling trees are replaced and the trees refined
+			{
+				RTT_TRACE_SCOPE("ppg resetQuadTree", p);
+				binaryTree->resetQuadTree(width, p);
+			}
+			{
+				RTT_TRACE_SCOPE("ppg refine", p);
+				binaryTree->refine(p);
+			}
 		}
-		mtx.lock();
 		binaryTree->reset();
-		mtx.unlock();
+		return completed;
+	}
+
+	// samples per pixel before the adaptive error estimate is trusted
+	const unsigned int adaptiveMinSpp = 8;
+
+	// spp samples per pixel starting at sample firstSample with the technique selected in the GUI,
+	// with the materials of the scene file if selected and there are any
+	bool renderPass(const std::unique_ptr<BVH>& bvh, std::vector<glm::vec3> &buffer, const GUI& gui, rtt::Camera &camera, EnvMap& envmap, const int spp, Sampler &sampler, const std::unique_ptr<Material> &material, std::unique_ptr<BinaryTree> &binaryTree, unsigned int firstSample, const CancelToken *cancel = nullptr, Film *film = nullptr, const Tile *region = nullptr, const MaterialTable *sceneMaterials = nullptr) {
+		if (gui.sceneMaterials && sceneMaterials != nullptr && !sceneMaterials->empty()) {
+			switch (gui.mode) {
+				case 0: // BSDF
+					return renderNextFrame_Stream<true, false>(bvh, buffer, gui.width, gui.height, camera, envmap, spp, sampler, gui.depth, gui.rouletteDepth, *sceneMaterials, firstSample, cancel, film, region);
+				case 1: // NEE
+					return renderNextFrame_Stream<false, true>(bvh, buffer, gui.width, gui.height, camera, envmap, spp, sampler, gui.depth, gui.rouletteDepth, *sceneMaterials, firstSample, cancel, film, region);
+				case 2: // MIS
+					return renderNextFrame_Stream<true, true>(bvh, buffer, gui.width, gui.height, camera, envmap, spp, sampler, gui.depth, gui.rouletteDepth, *sceneMaterials, firstSample, cancel, film, region);
+				default:
+					std::cout << "Something is wrong with the modes!" << std::endl;
+					return false;
+			}
+		}
+		switch (gui.mode) {
+			case 0: // BSDF
+				return renderNextFrame<true, false, false>(bvh, buffer, gui.width, gui.height, camera, envmap, spp, sampler, gui.depth, gui.rouletteDepth, std::ref(material), std::ref(binaryTree), 0, firstSample, cancel, film, region);
+			case 1: // NEE
+				return renderNextFrame<false, true, false>(bvh, buffer, gui.width, gui.height, camera, envmap, spp, sampler, gui.depth, gui.rouletteDepth, std::ref(material), std::ref(binaryTree), 0, firstSample, cancel, film, region);
+			case 2: // MIS
+				return renderNextFrame<true, true, false>(bvh, buffer, gui.width, gui.height, camera, envmap, spp, sampler, gui.depth, gui.rouletteDepth, std::ref(material), std::ref(binaryTree), 0, firstSample, cancel, film, region);
+			default:
+				std::cout << "Something is wrong with the modes!" << std::endl;
+				return false;
+		}
 	}
 
-	void render(const std::unique_ptr<BVH>& bvh, vector<vec3> &image, GUI& gui, EnvMap& envmap, Sampler& sampler) {
-		std::vector<glm::vec3> buffer(gui.width*gui.height);
+	// Render thread: follows the parameter snapshots published by the GUI and sleeps once the current accumulation is done
+	void render(const std::unique_ptr<BVH>& bvh, FrameExchange &frames, ParameterChannel &parameters, EnvMap& envmap, Sampler& sampler) {
+		std::shared_ptr<const GUI> settings = parameters.take(true);
+		if (settings == nullptr) return;
+		Film film(settings->width, settings->height);
 
-		while (!gui.quit) {
-			if (gui.changed || gui.changedMap) {
-				gui.changed = false;
+		Camera camera(settings->width, settings->height, settings->angleFOV, settings->cameraOrigin, settings->cameraAngle);
+		std::unique_ptr<Material> material;
+		MaterialTable sceneMaterials;
+		getSceneMaterials(bvh->materials, sceneMaterials);
+		std::unique_ptr<BinaryTree> binaryTree;
+		auto frameStart = std::chrono::steady_clock::now();
 
-				//TODO: use pipeline double/triple buffering
-				Camera camera(gui.width, gui.height, gui.angleFOV, gui.cameraOrigin, gui.cameraAngle);
-				if (gui.changedMap) {
-					gui.changedMap = false;
-					envmap.calculateEnvironmentMap(gui.envmapExposure);
-				}
+		Denoiser denoiser;
+		bool heatmapShown = false;
+		bool denoisedShown = false;
+		const auto display = [&](const GUI &gui) {
+			RTT_TRACE_SCOPE("display");
+			heatmapShown = gui.showSampleHeatmap;
+			denoisedShown = gui.denoise;
+			std::vector<glm::vec3> &buffer = frames.backBuffer();
+			if (heatmapShown) film.resolveSampleHeatmap(buffer);
+			else if (denoisedShown) denoiser.denoise(film, buffer);
+			else film.resolve(buffer);
+			frames.publish();
+		};
+
+		bool restart = true; // the first snapshot always starts an accumulation
+		bool idle = false; // nothing left to render with the current parameters
+		while (true) {
+			if (std::shared_ptr<const GUI> next = parameters.take(idle)) {
+				restart |= next->changed || next->changedMap;
+				settings = next;
+			}
+			if (parameters.closed()) break;
+			const GUI &gui = *settings;
+			idle = false;
+
+			if (restart) {
+				restart = false;
+				sampler.type = gui.curr_sampler;
+
+				camera = Camera(gui.width, gui.height, gui.angleFOV, gui.cameraOrigin, gui.cameraAngle);
+				if (gui.changedMap) envmap.calculateEnvironmentMap(gui.envmapExposure);
 				
-				std::unique_ptr<Material> material;
 				getMaterial(gui, std::ref(material));
-				std::unique_ptr<BinaryTree> binaryTree = std::make_unique<BinaryTree>(bvh->min_, bvh->max_, gui.c, gui.t);
+				binaryTree = std::make_unique<BinaryTree>(bvh->min_, bvh->max_, gui.c, gui.t);
+
+				// the view changed: start a new accumulation
+				film.reset();
+#ifdef RTT_INSTRUMENT
+				pixelCosts.reset(gui.width * gui.height);
+				mergeTraversalCounters();
+#endif
+				parameters.accumulatedSpp = 0;
+				frameStart = std::chrono::steady_clock::now();
 
 				if (gui.ppg) { // practical path guiding
 					switch (gui.mode) {
 						case 0: // BSDF
-							renderNextFrame_PPG<true, false>(bvh, buffer, image, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, std::ref(material), std::ref(binaryTree), gui.iterationNumber);
+							renderNextFrame_PPG<true, false>(bvh, frames, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, gui.rouletteDepth, std::ref(material), std::ref(binaryTree), gui.iterationNumber, &parameters.cancel);
 							std::cout << "BSDF ..." << std::endl;
 							break;
 						case 1: // NEE
-							renderNextFrame_PPG<false,true>(bvh, buffer, image, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, std::ref(material), std::ref(binaryTree), gui.iterationNumber);
+							renderNextFrame_PPG<false,true>(bvh, frames, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, gui.rouletteDepth, std::ref(material), std::ref(binaryTree), gui.iterationNumber, &parameters.cancel);
 							std::cout << "NEE ..." << std::endl;
 							break;
 						case 2: // MIS
-							renderNextFrame_PPG<true, true>(bvh, buffer, image, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, std::ref(material), std::ref(binaryTree), gui.iterationNumber);
+							renderNextFrame_PPG<true, true>(bvh, frames, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, gui.rouletteDepth, std::ref(material), std::ref(binaryTree), gui.iterationNumber, &parameters.cancel);
 							std::cout << "MIS ..." << std::endl;
 							break;
 						default:
 							std::cout << "Something is wrong with the modes!" << std::endl;
 					}
-				} else { // path tracing
-					switch (gui.mode) {
-						case 0: // BSDF
-							std::cout << "BSDF begins ..." << std::endl;
-							renderNextFrame<true, false, false>(bvh, buffer, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, std::ref(material), std::ref(binaryTree), 0);
-							std::cout << "BSDF completed ..." << std::endl;
-							std::swap(image, buffer);
-							break;
-						case 1: // NEE
-							std::cout << "NEE begins ..." << std::endl;
-							renderNextFrame<false, true, false>(bvh, buffer, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, std::ref(material), std::ref(binaryTree), 0);
-							std::cout << "NEE completed..." << std::endl;
-							std::swap(image, buffer);
-							break;
-						case 2: // MIS
-							std::cout << "MIS begins ..." << std::endl;
-							renderNextFrame<true, true, false>(bvh, buffer, gui.width, gui.height, camera, envmap, std::pow(2.f, gui.spp), sampler, gui.depth, std::ref(material), std::ref(binaryTree), 0);
-							std::cout << "MIS completed ..." << std::endl;
-							std::swap(image, buffer);
-							break;
-						default:
-							std::cout << "Something is wrong with the modes!" << std::endl;
-					}
 				}
-			}	
+			}
+
+			if (gui.ppg) { // PPG renders all its iterations at once
+				idle = true;
+				continue;
+			}
+
+			// path tracing: accumulate passes until the target spp or the time budget is reached
+			const unsigned int target = 1u << gui.spp;
+			if (target < film.samples) { // fewer samples requested than already accumulated: start over
+				film.reset();
+				frameStart = std::chrono::steady_clock::now();
+			}
+			if ((heatmapShown != gui.showSampleHeatmap || denoisedShown != gui.denoise) && film.samples > 0) display(gui);
+			const float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - frameStart).count();
+			if (film.samples >= target || film.activePixels == 0 || (gui.timeBudget > 0.f && elapsed >= gui.timeBudget)) {
+				idle = true;
+				continue;
+			}
+
+			// passes double the accumulated spp, so every pixel always holds a complete Sobol block
+			unsigned int spp = target - film.samples;
+			if (gui.progressive) spp = std::min(std::max(1u, film.samples), spp);
+			else if (gui.adaptive) spp = std::min(std::max(adaptiveMinSpp, film.samples), spp);
+
+			// a cancelled pass leaves the film consistent per pixel, the image keeps showing the last complete pass
+			if (!renderPass(bvh, frames.backBuffer(), gui, camera, envmap, spp, sampler, material, binaryTree, 0, &parameters.cancel, &film, nullptr, &sceneMaterials)) continue;
+			film.samples += spp;
+
+			// adaptive: the next rounds only go to the pixels whose error estimate is above the threshold
+			if (gui.adaptive && film.samples >= adaptiveMinSpp && film.samples < target)
+				film.updateActive(gui.errorThreshold);
+
+			display(gui);
+			parameters.accumulatedSpp = film.samples;
+
+			if (film.samples == target || film.activePixels == 0) {
+				const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - frameStart).count();
+				std::cout << "Frame completed: " << film.samples << " spp (average " << film.totalSamples() / (float) (gui.width * gui.height) << " spp) in " << ms << " ms" << std::endl;
+#ifdef RTT_INSTRUMENT
+				mergeTraversalCounters().print();
+				std::vector<glm::vec3> heatmap;
+				resolveHeatmap(pixelCosts.traversal, heatmap);
+				writePNG("images/cost_traversal.png", heatmap, gui.width, gui.height);
+				resolveHeatmap(pixelCosts.seconds, heatmap);
+				writePNG("images/cost_time.png", heatmap, gui.width, gui.height);
+#endif
+			}
 		}
 		return;
 	}
@@ -1,20 +1,137 @@
 #pragma once
 
 #include <iostream>
-#include <random> // The header for the generators.
+#include <cstdint>
 #include <ctime> // To seed the generator.
 
+// Counter-based generator: every random number is a pure function of (seed, pixel, sample index, dimension).
+// Each pixel sample gets its own stream, so threads never share state and the image does not depend on the schedule.
+//  - Independent: PCG4D hash, white noise
+//  - Sobol:       4D Sobol with Owen scrambling, padded every 4 dimensions ("Practical Hash-based Owen Scrambling", Burley 2020)
+//  - Padded2D:    2D Sobol with Owen scrambling, every dimension pair is shuffled and scrambled independently
 class Sampler {
 	public: 
-		const unsigned int seed;
-		std::mt19937_64 rng;
-		std::uniform_real_distribution<float> uniform; // in range [0,1)
-		Sampler() : seed(time(0)), rng(seed) {}
+		enum Type { Type_Independent, Type_Sobol, Type_Padded2D };
+		int type;
+		uint32_t seed;
+		uint32_t pixel;
+		uint32_t sampleIndex;
+		uint32_t dimension;
+		Sampler() : Sampler(time(0)) {}
+		Sampler(uint32_t seed, int type = Type_Independent) : type(type), seed(seed), pixel(0), sampleIndex(0), dimension(0), block(~0u) {}
+
+		void startPixelSample(uint32_t p, uint32_t s) {
+			pixel = p;
+			sampleIndex = s;
+			dimension = 0;
+			block = ~0u;
+		}
+
 		float next1D() {
-			return uniform(rng);
+			const uint32_t d = dimension++;
+			if ((d >> 2) != block) {
+				block = d >> 2;
+				fillBlock();
+			}
+			return toFloat(values[d & 3]);
 		}
+
 		glm::vec2 next2D() {
-			return glm::vec2(uniform(rng), uniform(rng) );
+			dimension += dimension & 1; // keep 2D samples on a stratified dimension pair
+			const float x = next1D();
+			return glm::vec2(x, next1D());
+		}
+
+		// "Hash Functions for GPU Rendering", Jarzynski and Olano 2020: 4 inputs -> 4 decorrelated outputs
+		void pcg4d(uint32_t x, uint32_t y, uint32_t z, uint32_t w) {
+			x = x * 1664525u + 1013904223u;
+			y = y * 1664525u + 1013904223u;
+			z = z * 1664525u + 1013904223u;
+			w = w * 1664525u + 1013904223u;
+
+			x += y * w; y += z * x; z += x * y; w += y * z;
+			x ^= x >> 16; y ^= y >> 16; z ^= z >> 16; w ^= w >> 16;
+			x += y * w; y += z * x; z += x * y; w += y * z;
+
+			values[0] = x; values[1] = y; values[2] = z; values[3] = w;
+		}
+
+		static float toFloat(uint32_t v) {
+			return (v >> 8) * 0x1p-24f; // in range [0,1)
+		}
+
+	private:
+		uint32_t block; // dimension / 4 of the cached values
+		uint32_t values[4];
+
+		// generator matrices of the first 4 Sobol dimensions (Joe and Kuo), most significant bit first
+		static constexpr uint32_t sobolDirections[4][32] = {
+		{ 0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000, 0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+		  0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100, 0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001 },
+		{ 0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000, 0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+		  0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00, 0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff },
+		{ 0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000, 0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+		  0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500, 0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555 },
+		{ 0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000, 0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+		  0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00, 0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093 }
+		};
+
+		static uint32_t sobol(uint32_t index, int dim) {
+			uint32_t x = 0;
+			for (int bit = 0; index != 0; index >>= 1, bit++) {
+				if (index & 1) x ^= sobolDirections[dim][bit];
+			}
+			return x;
+		}
+
+		static uint32_t reverseBits(uint32_t x) {
+			x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+			x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+			x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+			x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+			return (x >> 16) | (x << 16);
+		}
+
+		static uint32_t laineKarrasPermutation(uint32_t x, uint32_t s) {
+			x += s;
+			x ^= x * 0x6c50b47cu;
+			x ^= x * 0xb82f1e52u;
+			x ^= x * 0xc7afe638u;
+			x ^= x * 0x8d22f6e6u;
+			return x;
+		}
+
+		static uint32_t nestedUniformScramble(uint32_t x, uint32_t s) {
+			return reverseBits(laineKarrasPermutation(reverseBits(x), s));
+		}
+
+		static uint32_t hashCombine(uint32_t s, uint32_t v) {
+			return s ^ (v + 0x9e3779b9u + (s << 6) + (s >> 2));
+		}
+
+		void fillBlock() {
+			switch (type) {
+				case Type_Sobol:
+				{
+					const uint32_t s = hashCombine(hashCombine(seed, pixel), block);
+					const uint32_t index = nestedUniformScramble(sampleIndex, s);
+					for (int i = 0; i < 4; i++)
+						values[i] = nestedUniformScramble(sobol(index, i), hashCombine(s, i));
+					break;
+				}
+				case Type_Padded2D:
+				{
+					for (int pair = 0; pair < 2; pair++) {
+						const uint32_t s = hashCombine(hashCombine(seed, pixel), 2 * block + pair);
+						const uint32_t index = nestedUniformScramble(sampleIndex, s);
+						values[2 * pair]     = nestedUniformScramble(sobol(index, 0), hashCombine(s, 0));
+						values[2 * pair + 1] = nestedUniformScramble(sobol(index, 1), hashCombine(s, 1));
+					}
+					break;
+				}
+				default:
+					pcg4d(pixel, sampleIndex, block, seed);
+			}
 		}
 };
 // we pretend this is in NKS, i.e. normal is [0, 0, 1]
@@ -52,18 +169,34 @@ const glm::vec3 sampleSphere(glm::vec2 randomNumber) {
 
 }
 
-const glm::vec3 sampleGGXnormalD(Sampler &sampler, float alpha) {
+// pdf = cos / pi
+const glm::vec3 sampleCosineHemisphere(Sampler &sampler) {
 	glm::vec2 randomNumber = sampler.next2D();
-	const float xhi1 = randomNumber[0];
-	const float xhi2 = randomNumber[1];
+	const float r = std::sqrt(randomNumber[0]);
+	const float phi = randomNumber[1] * 2.f * M_PI;
 
-	const float phi = xhi2 * 2.f * M_PI;
-	const float tanTheta = alpha * std::sqrt(xhi1) / std::sqrt(1.f - xhi1);
-	const float theta = std::atan(tanTheta);
+	return glm::vec3(r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.f, 1.f - randomNumber[0])));
+}
 
-	const float x = std::sin(theta) * std::cos(phi);
-	const float y = std::sin(theta) * std::sin(phi);
-	const float z = std::cos(theta);
+// GGX microfacet normal sampled among the normals visible from wi (wi.z > 0), pdf = G1(wi) * max(0, <wi,h>) * D(h) / wi.z
+// ("Sampling the GGX Distribution of Visible Normals", Heitz 2018): no sample faces away from wi.
+const glm::vec3 sampleGGXVisibleNormal(Sampler &sampler, const glm::vec3 &wi, float alpha) {
+	glm::vec2 randomNumber = sampler.next2D();
 
-	return glm::vec3(x,y,z);
+	// stretch the view direction to the hemisphere configuration
+	const glm::vec3 vh = glm::normalize(glm::vec3(alpha * wi.x, alpha * wi.y, wi.z));
+	const float lensq = vh.x * vh.x + vh.y * vh.y;
+	const glm::vec3 t1 = lensq > 0.f ? glm::vec3(-vh.y, vh.x, 0.f) / std::sqrt(lensq) : glm::vec3(1.f, 0.f, 0.f);
+	const glm::vec3 t2 = glm::cross(vh, t1);
+
+	// point on the projected half disk
+	const float r = std::sqrt(randomNumber[0]);
+	const float phi = randomNumber[1] * 2.f * M_PI;
+	const float p1 = r * std::cos(phi);
+	const float s = 0.5f * (1.f + vh.z);
+	const float p2 = (1.f - s) * std::sqrt(1.f - p1 * p1) + s * r * std::sin(phi);
+	const glm::vec3 nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.f, 1.f - p1 * p1 - p2 * p2)) * vh;
+
+	// back to the ellipsoid configuration
+	return glm::normalize(glm::vec3(alpha * nh.x, alpha * nh.y, std::max(0.f, nh.z)));
 }
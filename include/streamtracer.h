@@ -0,0 +1,217 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+#include "ray.h"
+#include "camera.h"
+#include "triangle.h"
+#include "bvh.h"
+#include "envmap.h"
+#include "pathtracer.h"
+#include "threadpool.h"
+#include "tile.h"
+#include "film.h"
+#include "cancel.h"
+#include "trace.h"
+#include "materials/material.h"
+
+namespace rtt
+{
+	// materials of the scene file, indexed by Intersection::material
+	using MaterialTable = std::vector<std::unique_ptr<Material>>;
+
+	// camera path between two bounces of the stream integrator
+	class PathState {
+		public:
+			Ray ray;
+			Sampler sampler;
+			glm::vec3 throughput;
+			glm::vec3 color;
+			float bsdfPdf;
+			bool inside;
+			bool lightSampled; // the last vertex sampled the envmap: a BSDF ray reaching it is MIS weighted (or ignored without BSDF sampling)
+			unsigned int pixel; // in the tile
+
+			PathState() : ray(glm::vec3(0.f), glm::vec3(0.f, 0.f, 1.f)), sampler(0u), throughput(1.f), color(0.f), bsdfPdf(1.f), inside(false), lightSampled(false), pixel(0) {}
+	};
+
+	// scratch of a pool thread, reused across the tiles of a pass
+	class StreamBatch {
+		public:
+			std::vector<PathState> paths;
+			std::vector<Intersection> hits;
+			std::vector<unsigned int> active, next; // paths still bouncing
+			std::vector<unsigned int> order; // active hits grouped by material
+			std::vector<unsigned int> offsets; // first entry of every material in order
+			std::vector<unsigned int> pixels, firstSamples; // active pixels of the tile
+			std::vector<glm::vec3> colors;
+			std::vector<float> luminanceSq;
+			std::vector<FeatureSample> features;
+	};
+
+	// paths traced together, enough for coherent material batches while the scratch stays in the caches
+	const unsigned int streamBatchSize = 4096;
+
+	// one bounce of a path hitting material, returns false if the path ends here
+	template<bool bsdf, bool nee, class M>
+	bool shadeStreamHit(const std::unique_ptr<BVH>& bvh, const EnvMap &envmap, const M &material, const bool isMirror, PathState &path, const Intersection &its, const int depth, const int rouletteDepth)
+	{
+		if constexpr (std::is_same_v<M, Material_normal>) {
+			path.color = abs(its.normal);
+			return false;
+		}
+		Plane plane(its.normal);
+		glm::vec3 wi = plane.toLocal(-path.ray.direction);
+		float wo_pdf = 1.f;
+
+		if constexpr (nee) {
+			glm::vec3 d_world(0.f);
+			float envmapPDF = 0.f;
+			const glm::vec3 Li_nee = envmap.sampleEnvMap(path.sampler, d_world, envmapPDF) / envmapPDF;
+			glm::vec3 d = plane.toLocal(d_world);
+			Intersection its_envmap;
+			RTT_COUNT_RAY(Ray_Shadow);
+			bvh->intersect(its_envmap, Ray(its.position, d_world));
+			BSDF b_nee(wi, d, path.inside, wo_pdf);
+			if (!its_envmap.intersection && d.z >= 0.f && !b_nee.inside && !isMirror) { // check if envmap is occluded
+				const float weight = bsdf ? mis_balance(envmapPDF, material.pdf(b_nee)) : 1.f;
+				path.color += path.throughput * material.evaluate(b_nee) * Li_nee * d.z * weight;
+			}
+		}
+
+		glm::vec3 wo = wi;
+		BSDF b(wi, wo, path.inside, wo_pdf);
+		const glm::vec3 f = material.sample(b, path.sampler, false); // bsdf * cos / pdf
+		path.ray = Ray(its.position, plane.toGlobal(b.wo));
+		if constexpr (bsdf && nee) path.bsdfPdf = material.pdf(b);
+		path.throughput *= f;
+		path.inside = b.inside; // needed for conductors
+		path.lightSampled = nee && !isMirror;
+		return path.throughput != glm::vec3(0.f) && russianRoulette(path.throughput, path.sampler, depth, rouletteDepth);
+	}
+
+	// Path tracing with a material per triangle. The paths of a tile advance one bounce at a time: all of them are
+	// intersected, the hits are grouped by material (counting sort), and each material shades its whole group with the
+	// concrete BSDF type, instead of switching between materials from one ray to the next.
+	// Same contract as renderNextFrame, without PPG, except that a cancelled pass never writes part of a tile: the pixels
+	// of a tile are only written once all of its paths are traced.
+	template<bool bsdf, bool nee>
+	bool renderNextFrame_Stream(const std::unique_ptr<BVH>& bvh, std::vector<glm::vec3> &buffer, unsigned int width, unsigned int height, rtt::Camera &camera, EnvMap& envmap, const int spp, Sampler &sampler, const int depth, const int rouletteDepth, const MaterialTable &materials, unsigned int firstSample = 0, const CancelToken *cancel = nullptr, Film *film = nullptr, const Tile *region = nullptr)
+	{
+		RTT_TRACE_SCOPE("stream pass", spp);
+		const auto cancelled = [cancel]() { return cancel != nullptr && cancel->isCancelled(); };
+		std::vector<StreamBatch> batches(threadPool().size()); // owned by the pass, so that passes may run concurrently
+
+		const std::vector<Tile> tiles = region != nullptr ? createTiles(*region) : createTiles(width, height);
+		threadPool().parallelFor(tiles.size(), [&](unsigned int t, unsigned int thread) {
+			RTT_TRACE_SCOPE("tile", t);
+			const Tile &tile = tiles[t];
+			StreamBatch &batch = batches[thread];
+			batch.pixels.clear();
+			batch.firstSamples.clear();
+			for (unsigned int y = tile.y0; y < tile.y1; y++) {
+				for (unsigned int x = tile.x0; x < tile.x1; x++) {
+					const unsigned int pixel = width * y + x;
+					if (film != nullptr && !film->active[pixel]) continue;
+					batch.pixels.push_back(pixel);
+					batch.firstSamples.push_back(film != nullptr ? film->pixelSamples[pixel] : firstSample);
+				}
+			}
+			batch.colors.assign(batch.pixels.size(), glm::vec3(0.f));
+			batch.luminanceSq.assign(batch.pixels.size(), 0.f);
+			batch.features.assign(batch.pixels.size(), FeatureSample());
+
+			const unsigned int count = batch.pixels.size() * spp;
+			for (unsigned int begin = 0; begin < count; begin += streamBatchSize) {
+				if (cancelled()) return;
+				const unsigned int size = std::min(streamBatchSize, count - begin);
+				batch.paths.resize(size);
+				batch.hits.resize(size);
+				batch.active.clear();
+				for (unsigned int i = 0; i < size; i++) {
+					PathState &path = batch.paths[i];
+					path = PathState();
+					path.pixel = (begin + i) / spp;
+					const unsigned int pixel = batch.pixels[path.pixel];
+					path.sampler = Sampler(sampler.seed, sampler.type);
+					path.sampler.startPixelSample(pixel, batch.firstSamples[path.pixel] + (begin + i) % spp);
+					const glm::vec2 jitter = path.sampler.next2D();
+					const float u = camera.screenHeightDiv - camera.pixelY * (jitter.y + (float) (pixel / width));
+					const float v = camera.screenWidthDiv  + camera.pixelX * (jitter.x + (float) (pixel % width));
+					path.ray = Ray(camera.origin, camera.computeDirection(u, v));
+					batch.active.push_back(i);
+				}
+
+				for (int bounce = 1; bounce <= depth && !batch.active.empty(); bounce++) {
+					// intersect, the missed rays end on the envmap
+					batch.offsets.assign(materials.size() + 1, 0u);
+					for (unsigned int i : batch.active) {
+						PathState &path = batch.paths[i];
+						Intersection &its = batch.hits[i];
+						its = Intersection();
+						its.normal = envmap.direction_to_texture_coords(path.ray.direction);
+						RTT_COUNT_RAY(bounce == 1 ? Ray_Primary : Ray_Bounce);
+						bvh->intersect(its, path.ray);
+						if (bounce == 1 && film != nullptr) {
+							FeatureSample features;
+							recordFeatures(features, its, *materials[its.material]);
+							batch.features[path.pixel].normal += features.normal;
+							batch.features[path.pixel].albedo += features.albedo;
+							batch.features[path.pixel].depth  += features.depth;
+						}
+						if (its.intersection) {
+							batch.offsets[its.material + 1]++;
+						} else if (!path.inside) { // if the last bounce is refraction do not evaluate the envmap
+							if (!path.lightSampled) path.color += its.normal * path.throughput;
+							else if constexpr (bsdf) path.color += its.normal * path.throughput * mis_balance(path.bsdfPdf, envmap.getPDFfromDirection(path.ray.direction));
+						}
+					}
+
+					// counting sort of the hits by material
+					for (unsigned int m = 0; m < materials.size(); m++) batch.offsets[m + 1] += batch.offsets[m];
+					batch.order.resize(batch.offsets.back());
+					for (unsigned int i : batch.active)
+						if (batch.hits[i].intersection) batch.order[batch.offsets[batch.hits[i].material]++] = i;
+
+					// offsets now hold the end of every group
+					batch.next.clear();
+					unsigned int groupBegin = 0;
+					for (unsigned int m = 0; m < materials.size(); m++) {
+						const unsigned int groupEnd = batch.offsets[m];
+						if (groupBegin == groupEnd) continue;
+						visitMaterial(*materials[m], [&](const auto &material) {
+							const bool isMirror = isMirrorSurface(material);
+							for (unsigned int k = groupBegin; k < groupEnd; k++) {
+								const unsigned int i = batch.order[k];
+								if (shadeStreamHit<bsdf, nee>(bvh, envmap, material, isMirror, batch.paths[i], batch.hits[i], bounce, rouletteDepth)) batch.next.push_back(i);
+							}
+						});
+						groupBegin = groupEnd;
+					}
+					std::swap(batch.active, batch.next);
+				}
+
+				for (unsigned int i = 0; i < size; i++) {
+					const PathState &path = batch.paths[i];
+					batch.colors[path.pixel] += path.color;
+					batch.luminanceSq[path.pixel] += Film::luminance(path.color) * Film::luminance(path.color);
+				}
+			}
+
+			for (unsigned int p = 0; p < batch.pixels.size(); p++) {
+				const unsigned int pixel = batch.pixels[p];
+				if (film != nullptr) {
+					film->addSamples(pixel, batch.colors[p], batch.luminanceSq[p], spp);
+					film->addFeatures(pixel, batch.features[p].normal, batch.features[p].albedo, batch.features[p].depth);
+				} else {
+					buffer[pixel] = batch.colors[p] / (float) spp;
+				}
+			}
+		});
+		return !cancelled();
+	}
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+
+#include "omp.h"
+
+namespace rtt
+{
+	// Persistent work-stealing pool shared by rendering, BVH build and envmap preprocessing.
+	// Every thread owns a deque: it pops its own tasks from the front and steals from the back of the others.
+	// A thread waiting in parallelFor keeps executing tasks, so parallel loops can be nested.
+	// Slot size()-1 belongs to threads outside the pool (e.g. the render thread), which help while they wait.
+	// They share that slot and its thread index, which callers use to pick per-thread scratch, so they enter
+	// parallel loops one at a time.
+	class ThreadPool
+	{
+	private:
+		using Function = std::function<void(unsigned int, unsigned int, unsigned int)>; // begin, end, thread
+
+		struct Job
+		{
+			const Function *function;
+			std::atomic<unsigned int> remaining;
+		};
+
+		struct Task
+		{
+			Job *job;
+			unsigned int begin, end;
+		};
+
+		struct alignas(64) Slot
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+			std::atomic<long long> busy{0}; // ns spent executing tasks
+			std::atomic<unsigned long> executed{0};
+		};
+
+		std::vector<std::unique_ptr<Slot>> slots;
+		std::vector<std::thread> workers;
+		std::atomic<unsigned int> pending{0};
+		std::mutex sleepMutex;
+		std::condition_variable sleepCondition;
+		bool stop = false;
+		std::mutex outsideMutex; // held by the thread outside the pool that runs a parallel loop
+
+		// taken by a thread outside the pool for its outermost parallel loop, the loops nested in it reuse the turn
+		class OutsideTurn
+		{
+		private:
+			static int& nesting()
+			{
+				thread_local int depth = 0;
+				return depth;
+			}
+
+			std::unique_lock<std::mutex> lock;
+			const bool outside;
+
+		public:
+			explicit OutsideTurn(ThreadPool &pool) : outside(threadIndex() < 0)
+			{
+				if (outside && nesting()++ == 0) lock = std::unique_lock<std::mutex>(pool.outsideMutex);
+			}
+			~OutsideTurn() { if (outside) nesting()--; }
+		};
+
+		static int& threadIndex()
+		{
+			thread_local int index = -1;
+			return index;
+		}
+
+	public:
+		explicit ThreadPool(unsigned int threadCount)
+		{
+			threadCount = std::max(1u, threadCount);
+			for (unsigned int i = 0; i < threadCount; i++)
+				slots.push_back(std::make_unique<Slot>());
+			for (unsigned int i = 0; i + 1 < threadCount; i++)
+				workers.emplace_back(&ThreadPool::workerLoop, this, i);
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				stop = true;
+			}
+			sleepCondition.notify_all();
+			for (auto &worker : workers) worker.join();
+		}
+
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool& operator=(const ThreadPool &) = delete;
+
+		// sized like the OpenMP runtime so OMP_NUM_THREADS keeps working
+		static ThreadPool& instance()
+		{
+			static ThreadPool pool(omp_get_max_threads());
+			return pool;
+		}
+
+		unsigned int size() const { return slots.size(); }
+
+		unsigned int currentThread() const
+		{
+			const int index = threadIndex();
+			return index < 0 ? size() - 1 : index;
+		}
+
+		// calls function(begin, end, thread) on chunks of at most grain indices of [0, count)
+		void parallelForRange(unsigned int count, unsigned int grain, const Function &function)
+		{
+			if (count == 0) return;
+			const OutsideTurn turn(*this);
+			grain = std::max(1u, grain);
+			const unsigned int tasks = (count + grain - 1) / grain;
+			const unsigned int self = currentThread();
+			if (tasks == 1 || size() == 1)
+			{
+				run(Task{nullptr, 0, count}, function, self);
+				return;
+			}
+
+			Job job;
+			job.function = &function;
+			job.remaining.store(tasks);
+
+			// contiguous runs of tasks per thread keep neighbouring work (e.g. Morton ordered tiles) together
+			for (unsigned int s = 0; s < size(); s++)
+			{
+				const unsigned int first = (unsigned long) tasks * s / size();
+				const unsigned int last  = (unsigned long) tasks * (s + 1) / size();
+				Slot &slot = *slots[(self + s) % size()];
+				std::lock_guard<std::mutex> lock(slot.mutex);
+				for (unsigned int t = first; t < last; t++)
+					slot.tasks.push_back(Task{&job, t * grain, std::min(count, (t + 1) * grain)});
+			}
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				pending.fetch_add(tasks);
+			}
+			sleepCondition.notify_all();
+
+			while (job.remaining.load(std::memory_order_acquire) > 0)
+			{
+				Task task;
+				if (findTask(self, task)) execute(task, self);
+				else std::this_thread::yield();
+			}
+		}
+
+		// calls function(index, thread) for every index of [0, count), one task per index
+		void parallelFor(unsigned int count, const std::function<void(unsigned int, unsigned int)> &function)
+		{
+			parallelForRange(count, 1, [&function](unsigned int begin, unsigned int end, unsigned int thread) {
+				for (unsigned int i = begin; i < end; i++) function(i, thread);
+			});
+		}
+
+		void resetStats()
+		{
+			for (auto &slot : slots)
+			{
+				slot->busy.store(0);
+				slot->executed.store(0);
+			}
+		}
+
+		std::vector<double> busySeconds() const
+		{
+			std::vector<double> seconds;
+			for (const auto &slot : slots) seconds.push_back(slot->busy.load() * 1e-9);
+			return seconds;
+		}
+
+		// per-thread busy time against the wall clock time of the measured section
+		void printStats(double wallSeconds, std::ostream &out = std::cout) const
+		{
+			double total = 0.0;
+			out << "threads: " << size() << "\n";
+			for (unsigned int i = 0; i < size(); i++)
+			{
+				const double busy = slots[i]->busy.load() * 1e-9;
+				total += busy;
+				out << "  thread " << std::setw(3) << i << (i + 1 == size() ? " (caller)" : "         ")
+					<< " busy " << std::fixed << std::setprecision(3) << busy << " s (" << std::setprecision(1) << 100.0 * busy / wallSeconds << "%), "
+					<< slots[i]->executed.load() << " tasks\n";
+			}
+			out << "parallel efficiency: " << std::setprecision(1) << 100.0 * total / (wallSeconds * size()) << "%\n" << std::defaultfloat;
+		}
+
+	private:
+		void workerLoop(unsigned int index)
+		{
+			threadIndex() = index;
+			while (true)
+			{
+				Task task;
+				if (findTask(index, task))
+				{
+					execute(task, index);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepCondition.wait(lock, [this] { return stop || pending.load() > 0; });
+				if (stop && pending.load() == 0) return;
+			}
+		}
+
+		bool findTask(unsigned int self, Task &task)
+		{
+			if (pending.load(std::memory_order_relaxed) == 0) return false;
+			for (unsigned int s = 0; s < size(); s++)
+			{
+				Slot &slot = *slots[(self + s) % size()];
+				std::lock_guard<std::mutex> lock(slot.mutex);
+				if (slot.tasks.empty()) continue;
+				if (s == 0)
+				{
+					task = slot.tasks.front();
+					slot.tasks.pop_front();
+				}
+				else
+				{
+					task = slot.tasks.back();
+					slot.tasks.pop_back();
+				}
+				pending.fetch_sub(1);
+				return true;
+			}
+			return false;
+		}
+
+		void execute(const Task &task, unsigned int thread)
+		{
+			run(task, *task.job->function, thread);
+			task.job->remaining.fetch_sub(1, std::memory_order_release);
+		}
+
+		void run(const Task &task, const Function &function, unsigned int thread)
+		{
+			thread_local int nesting = 0; // tasks run while waiting inside a task are already timed by the outer one
+			const auto t1 = std::chrono::steady_clock::now();
+			nesting++;
+			function(task.begin, task.end, thread);
+			nesting--;
+			const auto t2 = std::chrono::steady_clock::now();
+			if (nesting == 0)
+				slots[thread]->busy.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count(), std::memory_order_relaxed);
+			slots[thread]->executed.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	ThreadPool& threadPool()
+	{
+		return ThreadPool::instance();
+	}
+}
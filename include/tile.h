@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+namespace rtt
+{
+	const unsigned int tileSize = 16;
+
+	class Tile {
+		public:
+			unsigned int x0, y0; // upper left pixel
+			unsigned int x1, y1; // lower right pixel (exclusive)
+			Tile(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+	};
+
+	inline unsigned int mortonCode(unsigned int x, unsigned int y) {
+		auto spread = [](unsigned int v) { // insert a 0 bit between every bit of the lower 16 bits
+			v &= 0x0000ffff;
+			v = (v | (v << 8)) & 0x00ff00ff;
+			v = (v | (v << 4)) & 0x0f0f0f0f;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		};
+		return spread(x) | (spread(y) << 1);
+	}
+
+	// tiles covering the region in Morton order, so consecutive tiles stay close to each other on screen
+	inline std::vector<Tile> createTiles(const Tile &region, unsigned int size = tileSize) {
+		const unsigned int tilesX = (region.x1 - region.x0 + size - 1) / size;
+		const unsigned int tilesY = (region.y1 - region.y0 + size - 1) / size;
+
+		std::vector<std::pair<unsigned int, Tile>> ordered;
+		ordered.reserve(tilesX * tilesY);
+		for (unsigned int ty = 0; ty < tilesY; ty++) {
+			for (unsigned int tx = 0; tx < tilesX; tx++) {
+				const unsigned int x0 = region.x0 + tx * size;
+				const unsigned int y0 = region.y0 + ty * size;
+				ordered.emplace_back(mortonCode(tx, ty), Tile(x0, y0, std::min(region.x1, x0 + size), std::min(region.y1, y0 + size)));
+			}
+		}
+		std::sort(ordered.begin(), ordered.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+		std::vector<Tile> tiles;
+		tiles.reserve(ordered.size());
+		for (const auto &[code, tile] : ordered) tiles.push_back(tile);
+		return tiles;
+	}
+
+	inline std::vector<Tile> createTiles(unsigned int width, unsigned int height, unsigned int size = tileSize) {
+		return createTiles(Tile(0, 0, width, height), size);
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+
+// Timeline of the render phases in the Chrome trace format (chrome://tracing, ui.perfetto.dev).
+// Tracing is enabled by setting RTT_TRACE to the path of the trace file, the executables write it at exit.
+// Every thread records its scopes into its own ring buffer, so recording takes no lock and never allocates;
+// when a buffer is full the oldest events of that thread are overwritten.
+namespace rtt
+{
+	class TraceEvent {
+		public:
+			const char *name; // string literal
+			long long begin; // ns since the start of the trace
+			long long duration;
+			int index; // tile, iteration ... -1 for none
+	};
+
+	class TraceBuffer {
+		public:
+			static constexpr unsigned int capacity = 1u << 16;
+			std::vector<TraceEvent> events;
+			unsigned long recorded = 0;
+			unsigned int thread;
+
+			explicit TraceBuffer(unsigned int thread) : events(capacity), thread(thread) {}
+
+			void record(const TraceEvent &event) { events[recorded++ % capacity] = event; }
+	};
+
+	class Tracer {
+		private:
+			std::mutex mutex;
+			std::vector<std::shared_ptr<TraceBuffer>> buffers; // kept after their thread exits
+			std::string path;
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			std::shared_ptr<TraceBuffer> addThread() {
+				std::lock_guard<std::mutex> lock(mutex);
+				buffers.push_back(std::make_shared<TraceBuffer>(buffers.size()));
+				return buffers.back();
+			}
+
+		public:
+			std::atomic<bool> enabled{false};
+
+			Tracer() {
+				if (const char *variable = std::getenv("RTT_TRACE")) {
+					path = variable;
+					enabled = !path.empty();
+				}
+			}
+
+			long long now() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(); }
+
+			void record(const char *name, long long begin, int index) {
+				thread_local std::shared_ptr<TraceBuffer> buffer = addThread();
+				buffer->record(TraceEvent{name, begin, now() - begin, index});
+			}
+
+			// writes the trace and stops recording, once the traced work is finished.
+			// The suffix is added to the path, for processes sharing the environment.
+			void finish(const std::string &suffix = "") {
+				if (!enabled.exchange(false)) return;
+				std::lock_guard<std::mutex> lock(mutex);
+				std::ofstream file(path + suffix);
+				if (!file) {
+					std::cout << "cannot write the trace " << path + suffix << std::endl;
+					return;
+				}
+				file << std::fixed;
+				file.precision(3); // microseconds
+				file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+				bool first = true;
+				for (const auto &buffer : buffers) {
+					file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread << ", \"args\": {\"name\": \"thread " << buffer->thread << "\"}}";
+					first = false;
+					const unsigned long count = std::min<unsigned long>(buffer->recorded, TraceBuffer::capacity);
+					for (unsigned long i = buffer->recorded - count; i < buffer->recorded; i++) {
+						const TraceEvent &event = buffer->events[i % TraceBuffer::capacity];
+						file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread
+							<< ", \"ts\": " << event.begin / 1000.0 << ", \"dur\": " << event.duration / 1000.0;
+						if (event.index >= 0) file << ", \"args\": {\"index\": " << event.index << "}";
+						file << "}";
+					}
+				}
+				file << "\n]}\n";
+				std::cout << "trace written to " << path + suffix << std::endl;
+			}
+	};
+
+	Tracer& tracer() {
+		static Tracer instance;
+		return instance;
+	}
+
+	// records the time from its construction to the end of the scope
+	class TraceScope {
+		private:
+			const char *name;
+			int index;
+			long long begin;
+
+		public:
+			TraceScope(const char *name, int index = -1) : name(name), index(index), begin(tracer().enabled.load(std::memory_order_relaxed) ? tracer().now() : -1) {}
+			~TraceScope() { if (begin >= 0) tracer().record(name, begin, index); }
+			TraceScope(const TraceScope &) = delete;
+			TraceScope& operator=(const TraceScope &) = delete;
+	};
+}
+
+#define RTT_TRACE_CONCAT_(a, b) a##b
+#define RTT_TRACE_CONCAT(a, b) RTT_TRACE_CONCAT_(a, b)
+// RTT_TRACE_SCOPE("name") or RTT_TRACE_SCOPE("name", index)
+#define RTT_TRACE_SCOPE(...) rtt::TraceScope RTT_TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
@@ -16,8 +16,9 @@ namespace rtt
 		float distance;
 		glm::vec3 normal;
 		glm::vec3 position;
+		unsigned short material; // index in the material table of the scene
 		// we might need the uv
-		Intersection() : distance(std::numeric_limits<float>::max()), intersection(false), normal(glm::vec3(0.f)), position(glm::vec3(0.f)) {}
+		Intersection() : distance(std::numeric_limits<float>::max()), intersection(false), normal(glm::vec3(0.f)), position(glm::vec3(0.f)), material(0) {}
 	};
 
 	template<class IndexSize, class MaterialIndexSize = unsigned short>
@@ -27,13 +28,13 @@ namespace rtt
 		IndexSize index_vertices[3]; //3f<3f>
 		// IndexSize index_normals[3]; //3f<3f>
 		// IndexSize index_uvs[3]; //3f<2f>
-		// MaterialIndexSize material_index;
+		MaterialIndexSize material_index;
 
 		TriangleIndices() = default;
 		TriangleIndices(const IndexSize &vert0, const IndexSize &vert1, const IndexSize &vert2,
 			 	 const IndexSize &norm0, const IndexSize &norm1, const IndexSize &norm2,
-				 const IndexSize &uv0,   const IndexSize &uv1,   const IndexSize &uv2)
-				//  const MaterialIndexSize material_index) 
+				 const IndexSize &uv0,   const IndexSize &uv1,   const IndexSize &uv2,
+				 const MaterialIndexSize material = 0)
 		{
 			index_vertices[0] = vert0;
 			index_vertices[1] = vert1;
@@ -44,7 +45,7 @@ namespace rtt
 			// index_uvs[0]      = uv0;
 			// index_uvs[1]      = uv1;
 			// index_uvs[2]      = uv2;
-			// material_index    = material_index;
+			material_index    = material;
 		}
 	};
 
@@ -52,6 +53,7 @@ namespace rtt
 	{
 	public:
 		glm::vec3 e1, e2, v0;
+		unsigned short material;
 
 		Triangle() = default;
 
@@ -65,6 +67,7 @@ namespace rtt
 			e1 = mesh_vertices[triangle.index_vertices[1]] - mesh_vertices[triangle.index_vertices[0]]; 
 			e2 = mesh_vertices[triangle.index_vertices[2]] - mesh_vertices[triangle.index_vertices[0]]; 
 			v0 = mesh_vertices[triangle.index_vertices[0]];
+			material = triangle.material_index;
 		}
 
 		void intersect(const Ray &ray, Intersection &its) const {
@@ -92,6 +95,7 @@ namespace rtt
 			its.distance = t;
 			its.normal = glm::normalize(cross(e1,e2));
             its.position = ray.origin + ray.direction * t;
+			its.material = material;
 			its.intersection = true;
 		}
 	};
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <math.h>
+#include <string>
+#include <chrono>
+
+#include <glm/glm.hpp>
+
+#include "render.h"
+#include "job.h"
+#include "parser.h"
+
+#include "mesh.h"
+#include "envmap.h"
+#include "bvh.h"
+
+#include "materials/material.h"
+
+// Headless batch renderer: the scene, its BVH and the environment map are loaded once, then every job is rendered in turn.
+// A job is one line of key=value settings (see job.h). Empty lines and lines starting with # are skipped.
+//
+// usage: ./batch <scene directory> <scene name> [job file, stdin if omitted or -]
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		std::cout << "usage: " << argv[0] << " <scene directory> <scene name> [job file]" << std::endl;
+		return 1;
+	}
+	const std::string dir_path = argv[1];
+	const std::string scene_name = argv[2];
+
+	std::ifstream jobFile;
+	if (argc > 3 && std::string(argv[3]) != "-") {
+		jobFile.open(argv[3]);
+		if (!jobFile) {
+			std::cout << "cannot open " << argv[3] << std::endl;
+			return 1;
+		}
+	}
+	std::istream &jobs = jobFile.is_open() ? jobFile : std::cin;
+
+	auto t1 = chrono::high_resolution_clock::now();
+	float exposure = GUI().envmapExposure;
+	EnvMap envmap(dir_path + "/" + scene_name + "/" + scene_name + ".exr", exposure);
+	const auto bvh = rtt::createBVH(dir_path + "/" + scene_name + "/", scene_name);
+	auto t2 = chrono::high_resolution_clock::now();
+	std::cout << "scene loaded in " << chrono::duration_cast<chrono::milliseconds>(t2 - t1).count() << " ms" << std::endl;
+
+	Sampler sampler;
+	rtt::Denoiser denoiser;
+	std::unique_ptr<rtt::Material> material;
+	rtt::MaterialTable sceneMaterials;
+	rtt::getSceneMaterials(bvh->materials, sceneMaterials);
+	std::vector<glm::vec3> image;
+
+	std::string line;
+	unsigned int lineNumber = 0, rendered = 0, failed = 0;
+	long long totalMs = 0;
+	while (std::getline(jobs, line)) {
+		lineNumber++;
+		if (line.find_first_not_of(" \t\r") == std::string::npos || line[line.find_first_not_of(" \t")] == '#') continue;
+
+		rtt::Job job;
+		job.output = "images/" + scene_name + "_job" + std::to_string(lineNumber) + ".ppm";
+		if (!rtt::parseJob(line, job)) {
+			std::cout << "job at line " << lineNumber << " skipped" << std::endl;
+			failed++;
+			continue;
+		}
+		GUI &settings = job.settings;
+
+		RTT_TRACE_SCOPE("job", lineNumber);
+		auto start = chrono::high_resolution_clock::now();
+		if (settings.envmapExposure != exposure) { // only recomputed when a job changes it
+			exposure = settings.envmapExposure;
+			envmap.calculateEnvironmentMap(exposure);
+		}
+		sampler.type = settings.curr_sampler;
+		rtt::Camera camera(settings.width, settings.height, settings.angleFOV, settings.cameraOrigin, settings.cameraAngle);
+		rtt::getMaterial(settings, material);
+		std::unique_ptr<BinaryTree> binaryTree = std::make_unique<BinaryTree>(bvh->min_, bvh->max_, settings.c, settings.t);
+		rtt::Film film(settings.width, settings.height);
+		image.resize(settings.width * settings.height);
+
+#ifdef RTT_INSTRUMENT
+		rtt::pixelCosts.reset(settings.width * settings.height);
+		rtt::mergeTraversalCounters();
+#endif
+		rtt::renderPass(bvh, image, settings, camera, envmap, job.spp, sampler, material, binaryTree, 0, nullptr, &film, nullptr, &sceneMaterials);
+		if (settings.denoise) denoiser.denoise(film, image);
+		else film.resolve(image);
+		auto end = chrono::high_resolution_clock::now();
+
+		rtt::writeImage(job.output, image, settings.width, settings.height);
+		const auto ms = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+		totalMs += ms;
+		rendered++;
+		std::cout << "job " << rendered << " (line " << lineNumber << "): " << settings.width << "x" << settings.height << ", " << job.spp << " spp, " << ms << " ms -> " << job.output << std::endl;
+#ifdef RTT_INSTRUMENT
+		// the cost heatmaps go next to the image, <output>_traversal.png and <output>_time.png
+		rtt::mergeTraversalCounters().print();
+		const std::string prefix = job.output.substr(0, job.output.find_last_of('.'));
+		rtt::resolveHeatmap(rtt::pixelCosts.traversal, image);
+		rtt::writeImage(prefix + "_traversal.png", image, settings.width, settings.height);
+		rtt::resolveHeatmap(rtt::pixelCosts.seconds, image);
+		rtt::writeImage(prefix + "_time.png", image, settings.width, settings.height);
+#endif
+	}
+
+	std::cout << rendered << " jobs rendered in " << totalMs << " ms";
+	if (failed > 0) std::cout << ", " << failed << " skipped";
+	std::cout << std::endl;
+	rtt::tracer().finish();
+	return failed > 0 ? 1 : 0;
+}
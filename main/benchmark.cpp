@@ -1,10 +1,13 @@
 #include <iostream>
 #include <vector>
-#include <math.h> 
-#include <string> 
+#include <math.h>
+#include <string>
 #include <limits>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <new>
+#include <cstdlib>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> // perspective, lookAt
@@ -12,6 +15,7 @@
 
 #include "render.h"
 #include "parser.h"
+#include "benchmark.h"
 
 #include "mesh.h"
 #include "envmap.h"
@@ -20,51 +24,291 @@
 #include "materials/material.h"
 #include "materials/material_dielectric.h"
 
-int main(){
+// Microbenchmarks of the hot functions (ns/op) and full frames of every integrator (rays/s, camera rays per second).
+// usage: ./benchmark [--json results.json] [--compare baseline.json] [--tolerance 0.1]
+// --compare flags the results worse than the baseline by more than the tolerance and exits with 1 if there are any.
+
+// every heap allocation of the process is counted, so the benchmark shows that rendering does not allocate per sample
+std::atomic<unsigned long> allocations{0};
+
+void* operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size == 0 ? 1 : size)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+int main(int argc, char **argv){
+	std::string jsonPath, baselinePath;
+	double tolerance = 0.1;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const std::string option = argv[i];
+		if (option == "--json") jsonPath = argv[i + 1];
+		else if (option == "--compare") baselinePath = argv[i + 1];
+		else if (option == "--tolerance") tolerance = std::atof(argv[i + 1]);
+		else std::cout << "unknown option " << option << std::endl;
+	}
+
+	std::vector<rtt::BenchmarkResult> results;
+	const auto record = [&](const std::string &name, const std::string &unit, double value) {
+		results.emplace_back(name, unit, value);
+		rtt::printBenchmarkResult(results.back());
+	};
+
 	string dir_path = "scenes";
-	string scene_name = "teapot";	
+	string scene_name = "teapot";
 	EnvMap envmap(dir_path + "/" + scene_name + "/" + scene_name + ".exr", 0.f);
 	Sampler sampler;
 
 
 	std::unique_ptr<rtt::Material> material = std::make_unique<rtt::Material_conductor>(0.f, glm::vec3{0.048778, 0.059582, 0.049317}, glm::vec3{4.5264, 3.5974, 2.8545});;
 
-	// TODO: allocate memory when initializing image
-	vector<vec3> image(640 * 480); 
+	const unsigned int width = 640, height = 480;
+	vector<vec3> image(width * height);
 
+	auto tb1 = chrono::high_resolution_clock::now();
 	const auto bvh = rtt::createBVH(dir_path + "/" + scene_name + "/", scene_name);
+	auto tb2 = chrono::high_resolution_clock::now();
+	record("bvh build", "ms", chrono::duration<double, std::milli>(tb2 - tb1).count());
 
 	std::unique_ptr<BinaryTree> binaryTree = std::make_unique<BinaryTree>(bvh->min_, bvh->max_);
 
-	const unsigned int frames = 16;
 	const glm::vec3 origin(-6.f, 3.f, -5.f);
 	const glm::vec3 angle(0.f, 45.f, 0.f);
-	rtt::Camera camera(640, 480, 90.f, origin, angle);
+	rtt::Camera camera(width, height, 90.f, origin, angle);
+
+	// ---------------------------------------------------------------- microbenchmarks, single thread
+
+	// random rays through the unit cube, and random triangles inside it
+	const unsigned int count = 1024; // power of two, the inputs are indexed with & (count - 1)
+	Sampler inputs(1u);
+	inputs.startPixelSample(0, 0);
+	std::vector<rtt::Ray> rays;
+	std::vector<rtt::Triangle> triangles(count);
+	for (unsigned int i = 0; i < count; i++) {
+		const glm::vec3 o = 4.f * sampleSphere(inputs.next2D());
+		const glm::vec3 target = inputs.next1D() * sampleSphere(inputs.next2D());
+		rays.emplace_back(o, glm::normalize(target - o));
+		triangles[i].v0 = 2.f * glm::vec3(inputs.next1D(), inputs.next1D(), inputs.next1D()) - 1.f;
+		triangles[i].e1 = glm::vec3(inputs.next1D(), inputs.next1D(), inputs.next1D()) - 0.5f;
+		triangles[i].e2 = glm::vec3(inputs.next1D(), inputs.next1D(), inputs.next1D()) - 0.5f;
+		triangles[i].material = 0;
+	}
+	record("triangle intersect", "ns/op", rtt::timeOperation(1 << 22, [&](unsigned int i) {
+		rtt::Intersection its;
+		triangles[i & (count - 1)].intersect(rays[(i >> 10) & (count - 1)], its);
+		rtt::benchmarkSink = rtt::benchmarkSink + its.intersection;
+	}));
+
+	// the box of the unit cube with its 45 degree counterpart, and the inverted rays like in BVH_template::intersect
+	rtt::BoundingVolume box;
+	box.bounds[0] = glm::vec3(-1.f);
+	box.bounds[1] = glm::vec3(1.f);
+	box.bounds45[0] = glm::vec3(-std::sqrt(3.f));
+	box.bounds45[1] = glm::vec3(std::sqrt(3.f));
+	std::vector<rtt::Ray> invRays, invRays45;
+	for (const auto &ray : rays) {
+		invRays.emplace_back(ray.origin, 1.f / ray.direction);
+		invRays45.emplace_back(glm::rotate(ray.origin, glm::radians(45.f), glm::vec3(1, 1, 1)), 1.f / glm::rotate(ray.direction, glm::radians(45.f), glm::vec3(1, 1, 1)));
+	}
+	record("box intersect", "ns/op", rtt::timeOperation(1 << 22, [&](unsigned int i) {
+		float distance;
+		rtt::benchmarkSink = rtt::benchmarkSink + box.intersect_box(invRays[i & (count - 1)], invRays45[i & (count - 1)], distance);
+	}));
+
+	// camera rays of the whole frame through the scene
+	const double bvhNs = rtt::timeOperation(width * height, [&](unsigned int i) {
+		const float u = camera.screenHeightDiv - camera.pixelY * (0.5f + (float) (i / width));
+		const float v = camera.screenWidthDiv  + camera.pixelX * (0.5f + (float) (i % width));
+		rtt::Intersection its;
+		bvh->intersect(its, rtt::Ray(camera.origin, camera.computeDirection(u, v)));
+		rtt::benchmarkSink = rtt::benchmarkSink + its.distance;
+	}, 3);
+	record("bvh intersect", "rays/s", 1e9 / bvhNs);
+
+	record("envmap getTexelID", "ns/op", rtt::timeOperation(1 << 20, [&](unsigned int i) {
+		inputs.startPixelSample(i, 0);
+		rtt::benchmarkSink = rtt::benchmarkSink + envmap.getTexelID(inputs);
+	}));
+	record("envmap sampleEnvMap", "ns/op", rtt::timeOperation(1 << 20, [&](unsigned int i) {
+		inputs.startPixelSample(i, 0);
+		glm::vec3 d;
+		float pdf;
+		rtt::benchmarkSink = rtt::benchmarkSink + envmap.sampleEnvMap(inputs, d, pdf).x + pdf;
+	}));
+
+	// sample and evaluate of every material, with its concrete type like in Li
+	GUI settings;
+	std::unique_ptr<rtt::Material> variant;
+	std::vector<glm::vec3> directions(count);
+	for (auto &d : directions) d = sampleHemisphere(inputs);
+	for (int m = 1; m < 5; m++) {
+		settings.curr_material = m;
+		settings.roughness = 0.3f;
+		rtt::getMaterial(settings, variant);
+		rtt::visitMaterial(*variant, [&](const auto &concreteMaterial) {
+			record(std::string(settings.materials[m]) + " sample", "ns/op", rtt::timeOperation(1 << 20, [&](unsigned int i) {
+				inputs.startPixelSample(i, 0);
+				glm::vec3 wi = directions[i & (count - 1)], wo = wi;
+				bool inside = false;
+				float pdf = 1.f;
+				rtt::BSDF b(wi, wo, inside, pdf);
+				rtt::benchmarkSink = rtt::benchmarkSink + concreteMaterial.sample(b, inputs, false).x;
+			}));
+			record(std::string(settings.materials[m]) + " evaluate", "ns/op", rtt::timeOperation(1 << 20, [&](unsigned int i) {
+				glm::vec3 wi = directions[i & (count - 1)], wo = directions[(i >> 10) & (count - 1)];
+				bool inside = false;
+				float pdf = 1.f;
+				rtt::BSDF b(wi, wo, inside, pdf);
+				rtt::benchmarkSink = rtt::benchmarkSink + concreteMaterial.evaluate(b).x;
+			}));
+		});
+	}
+	settings.roughness = GUI().roughness;
 
+	// a quadtree refined like a PPG iteration refines it, from directions clustered around one lobe
+	QuadTree quad;
+	std::vector<glm::vec2> points(count);
+	for (auto &p : points) p = glm::vec2(0.3f, 0.6f) + 0.1f * inputs.next2D();
+	for (int iteration = 0; iteration < 4; iteration++) {
+		if (iteration > 0) quad.prepareNextIteration();
+		for (const auto &p : points) quad.splatDirection(p, glm::vec3(1.f));
+	}
+	record("quadtree sample", "ns/op", rtt::timeOperation(1 << 20, [&](unsigned int i) {
+		inputs.startPixelSample(i, 0);
+		float pdf = 1.f;
+		rtt::benchmarkSink = rtt::benchmarkSink + quad.sampleFromQuadTree(inputs.next2D(), inputs, pdf).x;
+	}));
+	record("quadtree splat", "ns/op", rtt::timeOperation(1 << 20, [&](unsigned int i) {
+		quad.splatDirection(points[i & (count - 1)], glm::vec3(1.f));
+	}));
+
+	// ---------------------------------------------------------------- full frames, every thread of the pool
+
+	// 16 frames of the reference setup, with the thread pool and heap statistics
+	const unsigned int frames = 16;
+	rtt::threadPool().resetStats();
+	const unsigned long allocationsBefore = allocations.load();
 	auto t1 = chrono::high_resolution_clock::now();
 	for (unsigned int i = 0; i < frames; i++)
-		rtt::renderNextFrame<true, false, false>(bvh, image, 640, 480, camera, envmap, 8, sampler, 5, material, std::ref(binaryTree), 0);	
-
-	// for (unsigned int i = 0; i < 20; i++)
-	// {
-	// 	rtt::renderNextFrame(mesh_values, bvh, image, 640, 480, camera, envmap, 0, sampler, 5, material, false, std::ref(binaryTree), 0, false);	
-	// 	camera.origin.x += 1.0;
-	// }
-	// for (unsigned int i = 0; i < 20; i++)
-	// {
-	// 	rtt::renderNextFrame(mesh_values, bvh, image, 640, 480, camera, envmap, 0, sampler, 5, material, false, std::ref(binaryTree), 0, false);	
-	// 	camera.origin.y += 1.0;
-	// }	
-	// for (unsigned int i = 0; i < 20; i++)
-	// {
-	// 	rtt::renderNextFrame(mesh_values, bvh, image, 640, 480, camera, envmap, 0, sampler, 5, material, false, std::ref(binaryTree), 0, false);	
-	// 	camera.origin.z += 1.0;
-	// }
-
+		rtt::renderNextFrame<true, false, false>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, material, std::ref(binaryTree), 0);
 	auto t2 = chrono::high_resolution_clock::now();
+	const unsigned long frameAllocations = allocations.load() - allocationsBefore;
 	auto ms_count = chrono::duration_cast<chrono::milliseconds>(t2 - t1).count();
 	std::cout << "total time: " << ms_count << " ms\n";
 	std::cout << "average time per frame: " << (ms_count/frames) << " ms\n";
+	rtt::threadPool().printStats(ms_count / 1000.0);
+	std::cout << "heap allocations: " << frameAllocations << " (" << frameAllocations / (float) frames << " per frame, "
+		<< frameAllocations / (640.f * 480.f * 8.f * frames) << " per sample)\n";
+
+	// camera rays per second of frames frames with spp samples per pixel
+	const auto timeFrames = [&](const std::string &name, unsigned int frames, unsigned int spp, const auto &renderFrame) {
+		auto t3 = chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < frames; i++) renderFrame(i);
+		auto t4 = chrono::high_resolution_clock::now();
+		record(name, "rays/s", width * height * (double) spp * frames / chrono::duration<double>(t4 - t3).count());
+#ifdef RTT_INSTRUMENT
+		rtt::mergeTraversalCounters().print();
+#endif
+	};
+
+	// every integrator, 8 spp
+	timeFrames("frame bsdf", 4, 8, [&](unsigned int) {
+		rtt::renderNextFrame<true, false, false>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, material, std::ref(binaryTree), 0);
+	});
+	timeFrames("frame nee", 4, 8, [&](unsigned int) {
+		rtt::renderNextFrame<false, true, false>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, material, std::ref(binaryTree), 0);
+	});
+	timeFrames("frame mis", 4, 8, [&](unsigned int) {
+		rtt::renderNextFrame<true, true, false>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, material, std::ref(binaryTree), 0);
+	});
+	rtt::MaterialTable sceneMaterials;
+	rtt::getSceneMaterials(bvh->materials, sceneMaterials);
+	timeFrames("frame stream mis", 4, 8, [&](unsigned int) {
+		rtt::renderNextFrame_Stream<true, true>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, sceneMaterials);
+	});
+	// PPG iterations 0 to 2 render 1 + 2 + 4 spp
+	rtt::FrameExchange ppgFrames(width * height);
+	timeFrames("frame ppg mis", 1, 7, [&](unsigned int) {
+		std::unique_ptr<BinaryTree> guide = std::make_unique<BinaryTree>(bvh->min_, bvh->max_, GUI().c, GUI().t);
+		rtt::renderNextFrame_PPG<true, true>(bvh, ppgFrames, width, height, camera, envmap, 1, sampler, 5, GUI().rouletteDepth, material, guide, 2);
+	});
+
+	// camera fly-through: 20 frames along each axis, 4 spp
+	timeFrames("fly-through", 60, 4, [&](unsigned int i) {
+		glm::vec3 offset(0.f);
+		offset[i / 20] = (float) (i % 20);
+		camera.origin = origin + offset;
+		rtt::renderNextFrame<true, true, false>(bvh, image, width, height, camera, envmap, 4, sampler, 5, GUI().rouletteDepth, material, std::ref(binaryTree), 0);
+	});
+	camera.origin = origin;
+
+	// per material, Li is compiled for every concrete material type (MIS, 8 spp)
+	for (int m = 1; m < 5; m++) {
+		settings.curr_material = m;
+		rtt::getMaterial(settings, variant);
+		timeFrames(std::string("frame ") + settings.materials[m], 4, 8, [&](unsigned int) {
+			rtt::renderNextFrame<true, true, false>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, variant, std::ref(binaryTree), 0);
+		});
+	}
+
+	// the Fresnel tables of the dielectric and the conductor against the exact terms
+	settings.exactFresnel = true;
+	for (int m = 3; m < 5; m++) {
+		settings.curr_material = m;
+		rtt::getMaterial(settings, variant);
+		timeFrames(std::string("frame ") + settings.materials[m] + " (exact Fresnel)", 4, 8, [&](unsigned int) {
+			rtt::renderNextFrame<true, true, false>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, variant, std::ref(binaryTree), 0);
+		});
+	}
+	float fresnelError = 0.f;
+	for (int metal = 0; metal < 5; metal++) {
+		const rtt::Material_conductor conductor(0.1f, settings.getMetalEta(metal), settings.getMetalKappa(metal));
+		for (int i = 0; i <= 10000; i++) {
+			const glm::vec3 error = abs(conductor.fresnel(i / 10000.f) - conductor.fresnelExact(i / 10000.f));
+			fresnelError = std::max(fresnelError, std::max(error.x, std::max(error.y, error.z)));
+		}
+	}
+	const rtt::Material_dielectric dielectric(0.1f, settings.refIndex);
+	for (int i = 0; i <= 10000; i++) {
+		bool tir = false;
+		fresnelError = std::max(fresnelError, std::abs(dielectric.fresnel(i / 10000.f, tir, 1.f, settings.refIndex) - dielectric.fresnelExact(i / 10000.f, tir, 1.f, settings.refIndex)));
+		fresnelError = std::max(fresnelError, std::abs(dielectric.fresnel(i / 10000.f, tir, settings.refIndex, 1.f) - dielectric.fresnelExact(i / 10000.f, tir, settings.refIndex, 1.f)));
+	}
+	std::cout << "largest Fresnel table error: " << fresnelError << "\n";
+
+	// Russian roulette only rescales the surviving paths: the mean of an NEE frame must not move with it
+	const auto meanLuminance = [&](int rouletteDepth) {
+		rtt::renderNextFrame<false, true, false>(bvh, image, width, height, camera, envmap, 16, sampler, 8, rouletteDepth, material, std::ref(binaryTree), 0);
+		double sum = 0.0;
+		for (const glm::vec3 &pixel : image) sum += rtt::Film::luminance(pixel);
+		return sum / image.size();
+	};
+	const double withoutRoulette = meanLuminance(0);
+	const double withRoulette = meanLuminance(3);
+	const double rouletteDifference = 100.0 * (withRoulette / withoutRoulette - 1.0);
+	std::cout << "nee mean luminance: " << withoutRoulette << " without roulette, " << withRoulette << " with roulette from bounce 3 (" << rouletteDifference << "%)\n";
+	const bool rouletteBiased = std::abs(rouletteDifference) > 1.0; // far above the noise of 5 million paths
+	if (rouletteBiased) std::cout << "Russian roulette changes the mean of the nee frame\n";
+
+	// denoiser on an 8 spp frame with its feature buffers
+	rtt::Film film(width, height);
+	rtt::renderNextFrame<true, false, false>(bvh, image, width, height, camera, envmap, 8, sampler, 5, GUI().rouletteDepth, material, std::ref(binaryTree), 0, 0, nullptr, &film);
+	rtt::Denoiser denoiser;
+	auto t5 = chrono::high_resolution_clock::now();
+	denoiser.denoise(film, image);
+	auto t6 = chrono::high_resolution_clock::now();
+	record("denoise", "ms", chrono::duration<double, std::milli>(t6 - t5).count());
+
+	rtt::tracer().finish();
+	if (!jsonPath.empty() && rtt::writeBenchmarkResults(jsonPath, results)) std::cout << "results written to " << jsonPath << std::endl;
+	if (!baselinePath.empty()) {
+		std::vector<rtt::BenchmarkResult> baseline;
+		if (!rtt::readBenchmarkResults(baselinePath, baseline)) return 1;
+		if (rtt::compareBenchmarkResults(baseline, results, tolerance) > 0) return 1;
+	}
+	if (rouletteBiased) return 1;
 
 	cout << "Done!" << endl;
 	return 0;
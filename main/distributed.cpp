@@ -0,0 +1,342 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <glm/glm.hpp>
+
+#include "render.h"
+#include "job.h"
+#include "network.h"
+#include "parser.h"
+
+#include "mesh.h"
+#include "envmap.h"
+#include "bvh.h"
+
+#include "materials/material.h"
+
+// Distributed tile rendering. The coordinator splits the frame into tiles and hands them to worker processes over TCP,
+// a few tiles in flight per worker so that no worker waits for the network. Workers keep the scene loaded between frames
+// and render every tile on their own thread pool. The tiles of a lost worker are handed to the others.
+//
+// usage:
+//   ./distributed coordinator <scene directory> <scene name> <workers> [--port 5555] [--no-spawn] [--scaling] [--connect-timeout 120] [job settings]
+//   ./distributed worker <scene directory> <scene name> <host> <port>
+// The coordinator spawns its workers on this machine unless --no-spawn is given, in which case it waits for <workers>
+// workers started by hand (e.g. on other machines). With --scaling the frame is rendered with 1, 2, 4 ... <workers>
+// workers and the parallel efficiency is reported. Local workers share the cores: set OMP_NUM_THREADS accordingly.
+
+extern char **environ;
+
+using rtt::Connection;
+
+const unsigned int distributedTileSize = 64;
+const unsigned int tilesInFlight = 2;
+
+class Worker {
+	public:
+		Connection connection;
+		std::deque<unsigned int> assigned; // tiles sent and not returned yet, in order
+		unsigned int tilesRendered = 0;
+};
+
+// renders the job with the first count workers, returns false if every worker was lost.
+// Given a stream the tiles go to the file as they arrive instead of the image.
+bool renderDistributed(std::vector<Worker> &workers, unsigned int count, const std::string &jobLine, const rtt::Job &job, std::vector<glm::vec3> &image, rtt::TiledImageFile *stream) {
+	const unsigned int width = job.settings.width;
+	const unsigned int height = job.settings.height;
+	RTT_TRACE_SCOPE("distributed frame", count);
+	if (stream == nullptr) image.assign(width * height, glm::vec3(0.f));
+
+	const std::vector<rtt::Tile> tiles = rtt::createTiles(width, height, distributedTileSize);
+	std::deque<unsigned int> queue;
+	for (unsigned int t = 0; t < tiles.size(); t++) queue.push_back(t);
+
+	const auto drop = [&](Worker &worker) {
+		std::cout << "worker lost, " << worker.assigned.size() << " tiles handed to the others" << std::endl;
+		queue.insert(queue.begin(), worker.assigned.begin(), worker.assigned.end());
+		worker.assigned.clear();
+		worker.connection.close();
+	};
+
+	// every worker sets the job up (camera, material, envmap exposure) before receiving tiles
+	uint32_t type;
+	std::vector<char> payload;
+	for (unsigned int i = 0; i < count; i++) {
+		workers[i].tilesRendered = 0;
+		if (workers[i].connection.valid() && !workers[i].connection.send(Connection::Message_Job, jobLine)) drop(workers[i]);
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		if (workers[i].connection.valid() && !(workers[i].connection.receive(type, payload) && type == Connection::Message_Ready)) drop(workers[i]);
+	}
+
+	unsigned int done = 0;
+	std::vector<pollfd> fds;
+	std::vector<unsigned int> polled;
+	while (done < tiles.size()) {
+		fds.clear();
+		polled.clear();
+		for (unsigned int i = 0; i < count; i++) {
+			Worker &worker = workers[i];
+			while (worker.connection.valid() && worker.assigned.size() < tilesInFlight && !queue.empty()) {
+				const rtt::Tile &tile = tiles[queue.front()];
+				const uint32_t rect[4] = {tile.x0, tile.y0, tile.x1, tile.y1};
+				if (!worker.connection.send(Connection::Message_Tile, rect, sizeof(rect))) {
+					drop(worker);
+					break;
+				}
+				worker.assigned.push_back(queue.front());
+				queue.pop_front();
+			}
+			if (worker.connection.valid()) {
+				fds.push_back(pollfd{worker.connection.fd, POLLIN, 0});
+				polled.push_back(i);
+			}
+		}
+		if (fds.empty()) return false;
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR) continue; // interrupted by a signal
+			std::cout << "poll failed: " << std::strerror(errno) << std::endl;
+			return false;
+		}
+
+		for (unsigned int k = 0; k < fds.size(); k++) {
+			if (fds[k].revents == 0) continue;
+			Worker &worker = workers[polled[k]];
+			if (!worker.connection.receive(type, payload) || type != Connection::Message_Result || payload.size() < 4 * sizeof(uint32_t)) {
+				drop(worker);
+				continue;
+			}
+
+			// a worker renders its tiles in order
+			const rtt::Tile &tile = tiles[worker.assigned.front()];
+			const unsigned int tileWidth = tile.x1 - tile.x0;
+			if (payload.size() != 4 * sizeof(uint32_t) + tileWidth * (tile.y1 - tile.y0) * sizeof(glm::vec3)) {
+				drop(worker);
+				continue;
+			}
+			const char *pixels = payload.data() + 4 * sizeof(uint32_t);
+			if (stream != nullptr) {
+				if (!stream->writeTile(tile, reinterpret_cast<const glm::vec3*>(pixels))) {
+					std::cout << "cannot write the tile to " << job.output << std::endl;
+					return false;
+				}
+			} else {
+				for (unsigned int y = tile.y0; y < tile.y1; y++)
+					std::memcpy(&image[width * y + tile.x0], pixels + (y - tile.y0) * tileWidth * sizeof(glm::vec3), tileWidth * sizeof(glm::vec3));
+			}
+			worker.assigned.pop_front();
+			worker.tilesRendered++;
+			done++;
+		}
+	}
+	return true;
+}
+
+// waits for one worker with poll, so that a spawned worker that exits before connecting (bad scene, crash on load ...)
+// or a worker that never shows up stops the coordinator with a message instead of blocking accept forever
+Connection acceptWorker(int server, const std::vector<pid_t> &children, int timeoutSeconds) {
+	for (int waited = 0; waited < timeoutSeconds; waited++) {
+		pollfd fd{server, POLLIN, 0};
+		const int ready = poll(&fd, 1, 1000);
+		if (ready < 0 && errno != EINTR) {
+			std::cout << "poll failed: " << std::strerror(errno) << std::endl;
+			return Connection();
+		}
+		if (ready > 0 && (fd.revents & POLLIN)) return rtt::acceptConnection(server);
+		for (pid_t pid : children) {
+			if (waitpid(pid, nullptr, WNOHANG) == pid) {
+				std::cout << "worker " << pid << " exited before connecting" << std::endl;
+				return Connection();
+			}
+		}
+	}
+	std::cout << "no worker connected within " << timeoutSeconds << " s" << std::endl;
+	return Connection();
+}
+
+int coordinator(int argc, char **argv) {
+	if (argc < 5) {
+		std::cout << "usage: " << argv[0] << " coordinator <scene directory> <scene name> <workers> [--port 5555] [--no-spawn] [--scaling] [job settings]" << std::endl;
+		return 1;
+	}
+	const unsigned int workerCount = std::max(1, std::atoi(argv[4]));
+	unsigned short port = 5555;
+	bool spawn = true;
+	bool scaling = false;
+	int connectTimeout = 120; // seconds per worker, the workers load the scene before they connect
+	std::string jobLine;
+	for (int i = 5; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--port" && i + 1 < argc) port = std::atoi(argv[++i]);
+		else if (arg == "--no-spawn") spawn = false;
+		else if (arg == "--scaling") scaling = true;
+		else if (arg == "--connect-timeout" && i + 1 < argc) connectTimeout = std::max(1, std::atoi(argv[++i]));
+		else jobLine += arg + " ";
+	}
+
+	rtt::Job job;
+	job.output = std::string("images/") + argv[3] + "_distributed.ppm";
+	if (!rtt::parseJob(jobLine, job)) return 1;
+	if (job.settings.denoise) std::cout << "denoise is ignored in distributed mode" << std::endl;
+
+	const int server = rtt::listenOn(port);
+	if (server < 0) return 1;
+
+	std::vector<pid_t> children;
+	if (spawn) {
+		const std::string portName = std::to_string(port);
+		for (unsigned int i = 0; i < workerCount; i++) {
+			const char *args[] = {argv[0], "worker", argv[2], argv[3], "127.0.0.1", portName.c_str(), nullptr};
+			pid_t pid;
+			if (posix_spawn(&pid, argv[0], nullptr, nullptr, const_cast<char**>(args), environ) != 0) {
+				std::cout << "cannot spawn worker " << i << std::endl;
+				return 1;
+			}
+			children.push_back(pid);
+		}
+	}
+
+	std::cout << "waiting for " << workerCount << " workers on port " << port << std::endl;
+	std::vector<Worker> workers(workerCount);
+	for (Worker &worker : workers) {
+		worker.connection = acceptWorker(server, children, connectTimeout);
+		if (!worker.connection.valid()) {
+			close(server);
+			for (pid_t pid : children) kill(pid, SIGTERM);
+			for (pid_t pid : children) waitpid(pid, nullptr, 0);
+			return 1;
+		}
+	}
+	close(server);
+
+	std::vector<unsigned int> counts;
+	if (scaling) for (unsigned int n = 1; n < workerCount; n *= 2) counts.push_back(n);
+	counts.push_back(workerCount);
+
+	// .ppm and .pfm frames are written tile by tile and never assembled in memory, .exr and .png need the whole frame
+	const bool streamed = rtt::hasExtension(job.output, ".ppm") || rtt::hasExtension(job.output, ".pfm");
+	std::vector<glm::vec3> image;
+	double singleWorkerSeconds = 0.0;
+	bool completed = true;
+	for (unsigned int n : counts) {
+		std::unique_ptr<rtt::TiledImageFile> stream;
+		if (streamed) {
+			stream = std::make_unique<rtt::TiledImageFile>(job.output, job.settings.width, job.settings.height);
+			if (!stream->valid()) return 1;
+		}
+		auto t1 = chrono::high_resolution_clock::now();
+		completed = renderDistributed(workers, n, jobLine, job, image, stream.get());
+		auto t2 = chrono::high_resolution_clock::now();
+		if (!completed) {
+			std::cout << "the frame was not completed" << std::endl;
+			break;
+		}
+
+		const double seconds = chrono::duration<double>(t2 - t1).count();
+		std::cout << n << " workers: " << (unsigned int) (seconds * 1000.0) << " ms";
+		if (scaling) {
+			if (n == 1) singleWorkerSeconds = seconds;
+			std::cout << ", speedup " << singleWorkerSeconds / seconds << ", efficiency " << 100.0 * singleWorkerSeconds / (seconds * n) << "%";
+		}
+		std::cout << ", tiles per worker:";
+		for (unsigned int i = 0; i < n; i++) std::cout << " " << workers[i].tilesRendered;
+		std::cout << std::endl;
+	}
+
+	for (Worker &worker : workers) if (worker.connection.valid()) worker.connection.send(Connection::Message_Quit, nullptr, 0);
+	for (pid_t pid : children) waitpid(pid, nullptr, 0);
+
+	if (!completed) return 1;
+	if (!streamed && !rtt::writeImage(job.output, image, job.settings.width, job.settings.height)) return 1;
+	std::cout << "image written to " << job.output << std::endl;
+	rtt::tracer().finish();
+	return 0;
+}
+
+int worker(int argc, char **argv) {
+	if (argc < 6) {
+		std::cout << "usage: " << argv[0] << " worker <scene directory> <scene name> <host> <port>" << std::endl;
+		return 1;
+	}
+	const std::string dir_path = argv[2];
+	const std::string scene_name = argv[3];
+
+	float exposure = GUI().envmapExposure;
+	EnvMap envmap(dir_path + "/" + scene_name + "/" + scene_name + ".exr", exposure);
+	const auto bvh = rtt::createBVH(dir_path + "/" + scene_name + "/", scene_name);
+
+	Connection connection = rtt::connectTo(argv[4], std::atoi(argv[5]));
+	if (!connection.valid()) return 1;
+
+	rtt::Job job;
+	Sampler sampler;
+	std::unique_ptr<rtt::Camera> camera;
+	std::unique_ptr<rtt::Material> material;
+	rtt::MaterialTable sceneMaterials;
+	rtt::getSceneMaterials(bvh->materials, sceneMaterials);
+	std::unique_ptr<BinaryTree> binaryTree;
+	std::vector<glm::vec3> buffer;
+	std::vector<char> payload, result;
+
+	uint32_t type;
+	while (connection.receive(type, payload)) {
+		if (type == Connection::Message_Job) {
+			job = rtt::Job();
+			if (!rtt::parseJob(std::string(payload.begin(), payload.end()), job)) return 1;
+			GUI &settings = job.settings;
+			if (settings.envmapExposure != exposure) {
+				exposure = settings.envmapExposure;
+				envmap.calculateEnvironmentMap(exposure);
+			}
+			sampler.type = settings.curr_sampler;
+			camera = std::make_unique<rtt::Camera>(settings.width, settings.height, settings.angleFOV, settings.cameraOrigin, settings.cameraAngle);
+			rtt::getMaterial(settings, material);
+			binaryTree = std::make_unique<BinaryTree>(bvh->min_, bvh->max_, settings.c, settings.t);
+			buffer.resize(settings.width * settings.height);
+			if (!connection.send(Connection::Message_Ready, nullptr, 0)) return 1;
+		}
+		else if (type == Connection::Message_Tile && camera != nullptr && payload.size() == 4 * sizeof(uint32_t)) {
+			uint32_t rect[4];
+			std::memcpy(rect, payload.data(), sizeof(rect));
+			const rtt::Tile region(rect[0], rect[1], rect[2], rect[3]);
+			rtt::renderPass(bvh, buffer, job.settings, *camera, envmap, job.spp, sampler, material, binaryTree, 0, nullptr, nullptr, &region, &sceneMaterials);
+
+			// tile rectangle followed by its rows
+			const unsigned int tileWidth = region.x1 - region.x0;
+			result.resize(sizeof(rect) + tileWidth * (region.y1 - region.y0) * sizeof(glm::vec3));
+			std::memcpy(result.data(), rect, sizeof(rect));
+			for (unsigned int y = region.y0; y < region.y1; y++)
+				std::memcpy(result.data() + sizeof(rect) + (y - region.y0) * tileWidth * sizeof(glm::vec3), &buffer[job.settings.width * y + region.x0], tileWidth * sizeof(glm::vec3));
+			if (!connection.send(Connection::Message_Result, result.data(), result.size())) return 1;
+		}
+		else if (type == Connection::Message_Quit) {
+			break;
+		}
+		else {
+			std::cout << "unexpected message " << type << std::endl;
+			return 1;
+		}
+	}
+	rtt::tracer().finish(".worker" + std::to_string(getpid()));
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	std::signal(SIGPIPE, SIG_IGN); // a lost peer is reported by send instead
+	const std::string mode = argc > 1 ? argv[1] : "";
+	if (mode == "coordinator") return coordinator(argc, argv);
+	if (mode == "worker") return worker(argc, argv);
+	std::cout << "usage: " << argv[0] << " coordinator|worker ..." << std::endl;
+	return 1;
+}
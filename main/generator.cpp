@@ -0,0 +1,179 @@
+#include <iostream>
+#include <vector>
+#include <math.h>
+#include <string>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+
+#define TINYEXR_IMPLEMENTATION
+#include "imageio.h"
+
+// Synthetic scenes to test the renderer at sizes and shapes the teapot does not cover. Writes
+// <directory>/<name>/<name>.xml (Mitsuba), <directory>/<name>/models/<name>.obj and an environment map
+// <directory>/<name>/<name>.exr, the geometry fits in the unit sphere around the origin (camera origin=0,0,-3).
+//
+// usage: ./generator <directory> <name> <sphere|soup|grid> <triangles> [seed]
+//   sphere: one tessellated sphere
+//   soup:   random triangles in the unit cube, overlapping and in every orientation
+//   grid:   a small sphere instanced on a grid (the instances are written out, the loader has no instancing)
+
+// OBJ vertices and faces as the parser reads them: one shared uv and normal, v/vt/vn faces
+class ObjWriter {
+	private:
+		FILE *file;
+		std::vector<char> buffer;
+
+	public:
+		unsigned long vertices = 0;
+		unsigned long triangles = 0;
+
+		explicit ObjWriter(const std::string &path) : file(std::fopen(path.c_str(), "w")), buffer(1 << 20) {
+			if (file == nullptr) return;
+			std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+			std::fprintf(file, "vt 0 0\nvn 0 0 1\n");
+		}
+		~ObjWriter() { if (file != nullptr) std::fclose(file); }
+
+		bool valid() const { return file != nullptr; }
+
+		unsigned long vertex(const glm::vec3 &p) {
+			std::fprintf(file, "v %.6g %.6g %.6g\n", p.x, p.y, p.z);
+			return ++vertices;
+		}
+
+		void triangle(unsigned long a, unsigned long b, unsigned long c) {
+			std::fprintf(file, "f %lu/1/1 %lu/1/1 %lu/1/1\n", a, b, c);
+			triangles++;
+		}
+
+		// wound so that the normal points away from center, the renderer culls back faces
+		void triangle(unsigned long a, unsigned long b, unsigned long c, const glm::vec3 &pa, const glm::vec3 &pb, const glm::vec3 &pc, const glm::vec3 &center) {
+			if (glm::dot(glm::cross(pb - pa, pc - pa), pa + pb + pc - 3.f * center) >= 0.f) triangle(a, b, c);
+			else triangle(a, c, b);
+		}
+};
+
+// latitude-longitude sphere of about 4 * rings^2 triangles
+void writeSphere(ObjWriter &obj, const glm::vec3 &center, float radius, unsigned int rings) {
+	rings = std::max(rings, 2u);
+	const unsigned int segments = 2 * rings;
+	const auto point = [&](unsigned int ring, unsigned int segment) {
+		const float theta = M_PI * ring / rings;
+		const float phi = 2.f * M_PI * segment / segments;
+		return center + radius * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+	};
+	std::vector<glm::vec3> positions;
+	const unsigned long top = obj.vertex(point(0, 0));
+	positions.push_back(point(0, 0));
+	const unsigned long first = obj.vertices + 1; // ring 1, segment 0
+	for (unsigned int i = 1; i < rings; i++) {
+		for (unsigned int j = 0; j < segments; j++) {
+			obj.vertex(point(i, j));
+			positions.push_back(point(i, j));
+		}
+	}
+	const unsigned long bottom = obj.vertex(point(rings, 0));
+	positions.push_back(point(rings, 0));
+
+	const auto index = [&](unsigned int ring, unsigned int segment) { return first + (ring - 1) * segments + segment % segments; };
+	const auto position = [&](unsigned long i) { return positions[i - top]; };
+	const auto add = [&](unsigned long a, unsigned long b, unsigned long c) { obj.triangle(a, b, c, position(a), position(b), position(c), center); };
+	for (unsigned int j = 0; j < segments; j++) {
+		add(top, index(1, j), index(1, j + 1));
+		add(bottom, index(rings - 1, j), index(rings - 1, j + 1));
+		for (unsigned int i = 1; i + 1 < rings; i++) {
+			add(index(i, j), index(i + 1, j), index(i + 1, j + 1));
+			add(index(i, j), index(i + 1, j + 1), index(i, j + 1));
+		}
+	}
+}
+
+void writeSoup(ObjWriter &obj, unsigned long triangles, std::mt19937 &random) {
+	std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+	// about as large as the spacing of their centers, so that the triangles overlap a bit
+	const float size = 2.f / std::cbrt((float) triangles);
+	for (unsigned long t = 0; t < triangles; t++) {
+		const glm::vec3 center(uniform(random), uniform(random), uniform(random));
+		unsigned long v[3];
+		for (unsigned long &i : v) i = obj.vertex(center + size * glm::vec3(uniform(random), uniform(random), uniform(random)));
+		obj.triangle(v[0], v[1], v[2]);
+	}
+}
+
+void writeGrid(ObjWriter &obj, unsigned long triangles) {
+	const unsigned int rings = 8; // 224 triangles per instance
+	const unsigned long perInstance = 4 * rings * (rings - 1);
+	const unsigned int side = std::max(1u, (unsigned int) std::ceil(std::sqrt(triangles / (double) perInstance)));
+	const float spacing = 2.f / side;
+	for (unsigned int x = 0; x < side; x++)
+		for (unsigned int z = 0; z < side; z++)
+			writeSphere(obj, glm::vec3(-1.f + spacing * (x + 0.5f), 0.f, -1.f + spacing * (z + 0.5f)), 0.4f * spacing, rings);
+}
+
+// sky gradient over a dark ground with a small bright sun, so that NEE has something to find
+bool writeEnvironment(const std::string &path) {
+	const unsigned int width = 256, height = 128;
+	std::vector<glm::vec3> image(width * height);
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			const float v = (y + 0.5f) / height;
+			glm::vec3 color = v < 0.5f ? glm::mix(glm::vec3(0.2f, 0.35f, 0.8f), glm::vec3(0.9f), 2.f * v) : glm::vec3(0.15f);
+			const float du = (x + 0.5f) / width - 0.3f, dv = v - 0.25f;
+			if (du * du + dv * dv < 0.0004f) color = glm::vec3(200.f, 180.f, 150.f);
+			image[width * y + x] = color;
+		}
+	}
+	return rtt::writeEXR(path, image, width, height);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 5) {
+		std::cout << "usage: " << argv[0] << " <directory> <name> <sphere|soup|grid> <triangles> [seed]" << std::endl;
+		return 1;
+	}
+	const std::string directory = std::string(argv[1]) + "/" + argv[2] + "/";
+	const std::string name = argv[2];
+	const std::string kind = argv[3];
+	const unsigned long triangles = std::strtoul(argv[4], nullptr, 10);
+	std::mt19937 random(argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 1u);
+
+	mkdir(argv[1], 0755);
+	mkdir(directory.c_str(), 0755);
+	mkdir((directory + "models").c_str(), 0755);
+
+	{
+		ObjWriter obj(directory + "models/" + name + ".obj");
+		if (!obj.valid()) {
+			std::cout << "cannot write " << directory << "models/" << name << ".obj" << std::endl;
+			return 1;
+		}
+		if (kind == "sphere") writeSphere(obj, glm::vec3(0.f), 1.f, (unsigned int) std::ceil(std::sqrt(triangles / 4.0)));
+		else if (kind == "soup") writeSoup(obj, triangles, random);
+		else if (kind == "grid") writeGrid(obj, triangles);
+		else {
+			std::cout << "unknown scene kind " << kind << std::endl;
+			return 1;
+		}
+		std::cout << obj.triangles << " triangles, " << obj.vertices << " vertices" << std::endl;
+	}
+
+	FILE *xml = std::fopen((directory + name + ".xml").c_str(), "w");
+	if (xml == nullptr) {
+		std::cout << "cannot write " << directory << name << ".xml" << std::endl;
+		return 1;
+	}
+	std::fprintf(xml, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n\n<scene version=\"0.5.0\" >\n"
+		"\t<bsdf type=\"diffuse\" id=\"Material\" >\n\t\t<rgb name=\"reflectance\" value=\"0.7, 0.7, 0.7\"/>\n\t</bsdf>\n"
+		"\t<shape type=\"obj\" >\n\t\t<string name=\"filename\" value=\"models/%s.obj\" />\n\t\t<ref id=\"Material\" />\n\t</shape>\n</scene>\n", name.c_str());
+	std::fclose(xml);
+
+	if (!writeEnvironment(directory + name + ".exr")) return 1;
+	std::cout << "scene written to " << directory << std::endl;
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <glm/glm.hpp>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <math.h> 
 #include <fstream> //save image
 #include <string.h> 
@@ -12,51 +13,43 @@
 #include "imgui_impl_opengl3.h"
 
 #include "gui.h"
+#include "parameters.h"
+#include "imageio.h"
 
 using namespace glm;
 using namespace std;
 
-// Display image in the background
-bool loadTextureFromImage(GLuint &out_texture, const int w, const int h, const vector<vec3> &image) {
-	unsigned char image_data[w * h * 3];
-	if (image_data == NULL) return false;
-	
-	//Create Texture
-	GLuint image_texture;
-	glGenTextures(1, &image_texture);
-	glBindTexture(GL_TEXTURE_2D, image_texture);
+// Display image in the background: the texture is created once and only updated when a new frame arrives
+GLuint createTexture(const int w, const int h) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of 3 * w bytes
 
-	// PARSE VECTOR TO UNSIGNED CHAR3
-	for (int i = 0; i < w * h; i++) 
-	{
-		image_data[3 * i    ] = (unsigned char)(std::min(1.f, image[i][0]) * 255);
-		image_data[3 * i + 1] = (unsigned char)(std::min(1.f, image[i][1]) * 255);
-		image_data[3 * i + 2] = (unsigned char)(std::min(1.f, image[i][2]) * 255);
-	}
-	
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data);
-	out_texture = std::move(image_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	return texture;
+}
+
+// float to 8 bit into the staging buffer, rows in parallel and pixels vectorized, then upload
+void updateTexture(GLuint texture, const int w, const int h, const vector<vec3> &image, vector<unsigned char> &staging) {
+	staging.resize(3 * w * h);
+	// same conversion as the saved PNG. Serial: one pass over the frame, while the thread pool renders the next one
+	rtt::toBytes(image.data(), staging.data(), w * h);
 
-	return true;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, staging.data());
 }
 
+// linear HDR as EXR, and a clamped PNG for viewing
 void saveImage(const vector<vec3>& image, const GUI& gui, const string sceneName) {
-	string imageName = "images/" + sceneName + "_" + to_string(gui.angleFOV) + "_" + to_string(gui.cameraOrigin) + "_image.ppm";
-	ofstream outfile (imageName, ios::out | ios::binary);  
-	outfile << "P6\n" << gui.width << " " << gui.height << "\n255\n"; 
-	
-	for (unsigned int i = 0; i < gui.width * gui.height; ++i) { 
-		outfile << (unsigned char)(std::min(1.f, image[i][0]) * 255) << 
-			(unsigned char)(std::min(1.f, image[i][1]) * 255) << 
-			(unsigned char)(std::min(1.f, image[i][2]) * 255); 
-	}
- 
-	outfile.close();
+	string imageName = "images/" + sceneName + "_" + to_string(gui.angleFOV) + "_" + to_string(gui.cameraOrigin) + "_image";
+	rtt::writeEXR(imageName + ".exr", image, gui.width, gui.height);
+	rtt::writePNG(imageName + ".png", image, gui.width, gui.height);
 }
 
-void view_gui(const vector<vec3> &image, GUI& gui) {
+void view_gui(rtt::FrameExchange &frames, GUI& gui, rtt::ParameterChannel &parameters) {
 	int width = gui.width;
 	int height = gui.height;
 
@@ -85,6 +78,11 @@ void view_gui(const vector<vec3> &image, GUI& gui) {
 	ImGui::StyleColorsDark();
 	ImGui_ImplGlfw_InitForOpenGL(window, true);
 	ImGui_ImplOpenGL3_Init("#version 150");
+	glfwSwapInterval(1);
+
+	vector<unsigned char> staging;
+	const GLuint texture = createTexture(width, height);
+	updateTexture(texture, width, height, frames.frontBuffer(), staging);
 
 	while (!glfwWindowShouldClose(window)) {
 		if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -95,8 +93,9 @@ void view_gui(const vector<vec3> &image, GUI& gui) {
 		ImGui_ImplGlfw_NewFrame();
 		ImGui::NewFrame();
 
-		GLuint texture = 0;
-		loadTextureFromImage(texture, width, height, image);
+		const bool newFrame = frames.acquire(); // latest complete frame, never blocks the renderer
+		const vector<vec3> &image = frames.frontBuffer();
+		if (newFrame) updateTexture(texture, width, height, image, staging);
 
 		ImGui::Begin("Properties");
 		ImGui::GetBackgroundDrawList()->AddImage((ImTextureID)(intptr_t)texture, ImVec2(0,0), ImVec2(width,height), ImVec2(0,0), ImVec2(1,1), IM_COL32_WHITE);
@@ -121,10 +120,22 @@ void view_gui(const vector<vec3> &image, GUI& gui) {
 		}
 
 		if (ImGui::TreeNode("Scene setup")) {
-			gui.changed |= ImGui::SliderInt("SPP: 2^s", &gui.spp, 0, 10);
-			gui.changed |= ImGui::SliderInt("Max length of path", &gui.depth, 1, 15);
+			gui.updated |= ImGui::SliderInt("SPP: 2^s", &gui.spp, 0, 10); // only moves the target, the accumulation continues
+			gui.updated |= ImGui::Checkbox("Progressive", &gui.progressive);
+			gui.updated |= ImGui::SliderFloat("Time budget (s), 0: none", &gui.timeBudget, 0.f, 120.f);
+			ImGui::Text("Accumulated: %d / %d spp", parameters.accumulatedSpp.load(), 1 << gui.spp);
+			gui.updated |= ImGui::Checkbox("Denoise (a-trous, albedo/normal/depth guided)", &gui.denoise);
+			gui.changed |= ImGui::Checkbox("Adaptive sampling", &gui.adaptive);
+			if (gui.adaptive) {
+				gui.changed |= ImGui::SliderFloat("Relative error threshold", &gui.errorThreshold, 0.001f, 0.2f);
+				gui.updated |= ImGui::Checkbox("Show sample count heatmap", &gui.showSampleHeatmap);
+			}
+			gui.changed |= ImGui::SliderInt("Max length of path", &gui.depth, 1, 64);
+			gui.changed |= ImGui::SliderInt("Russian roulette from bounce (0: off)", &gui.rouletteDepth, 0, 16);
+			gui.changed |= ImGui::Combo("Sampler", &gui.curr_sampler, gui.samplers, IM_ARRAYSIZE(gui.samplers));
 			ImGui::Dummy(ImVec2(15,15));
 
+			gui.changed |= ImGui::Checkbox("Materials of the scene file", &gui.sceneMaterials);
 			gui.changed |= ImGui::Combo("Materials", &gui.curr_material, gui.materials, IM_ARRAYSIZE(gui.materials));
 	
 			if (gui.curr_material == 2) { // Diffuse
@@ -138,6 +149,8 @@ void view_gui(const vector<vec3> &image, GUI& gui) {
 				gui.changed |= ImGui::SliderFloat("Roughness", &gui.roughness, 0.f, 3.f);
 				gui.changed |= ImGui::Combo("Metals", &gui.curr_metal, gui.metals, IM_ARRAYSIZE(gui.metals));
 			}
+			if (gui.curr_material == 3 || gui.curr_material == 4)
+				gui.changed |= ImGui::Checkbox("Exact Fresnel (validation)", &gui.exactFresnel);
 			ImGui::TreePop();
 		}
 
@@ -149,15 +162,21 @@ void view_gui(const vector<vec3> &image, GUI& gui) {
 
 			gui.changed |= ImGui::Checkbox("PPG enabled ", &gui.ppg);
 			if (ImGui::TreeNode("PPG properties")) {
-				ImGui::SliderInt("Iteration Number", &gui.iterationNumber, 0, 10);
-				ImGui::InputInt("Binary Tree split constatnt", &gui.c);
-				ImGui::SliderFloat("Quad Tree flux threshold", &gui.t, 0.0000001f, 1.0f);
+				gui.updated |= ImGui::SliderInt("Iteration Number", &gui.iterationNumber, 0, 10); // used from the next restart on
+				gui.updated |= ImGui::InputInt("Binary Tree split constatnt", &gui.c);
+				gui.updated |= ImGui::SliderFloat("Quad Tree flux threshold", &gui.t, 0.0000001f, 1.0f);
 				ImGui::TreePop();
 			}
 
 			ImGui::TreePop();
 		}
 
+		// the render thread only sees the parameters through snapshots, a restart cancels its running pass
+		if (gui.changed || gui.changedMap || gui.updated) {
+			parameters.publish(gui);
+			gui.changed = gui.changedMap = gui.updated = false;
+		}
+
 		ImGui::Dummy(ImVec2(15,15));
 		if (ImGui::Button("Save Image"))
 			saveImage(image, gui, "cube");
@@ -172,11 +191,12 @@ void view_gui(const vector<vec3> &image, GUI& gui) {
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
 		// glfw: swap buffers and poll IO events
+		// without new frames the loop sleeps until an input event, or until the renderer may have published one
 		glfwSwapBuffers(window);
-		glfwPollEvents();
-
-		glDeleteTextures(1, &texture);
+		if (newFrame) glfwPollEvents();
+		else glfwWaitEventsTimeout(1.0 / 30.0);
 	}
+	glDeleteTextures(1, &texture);
 	// Cleanup
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
@@ -185,5 +205,5 @@ void view_gui(const vector<vec3> &image, GUI& gui) {
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
-	gui.quit = true;
+	parameters.close();
 }
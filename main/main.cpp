@@ -30,8 +30,11 @@ int main(){
 	EnvMap envmap(dir_path + "/" + scene_name + "/" + scene_name + ".exr", gui.envmapExposure);
 	Sampler sampler;
 
-	// TODO: allocate memory when initializing image
-	vector<vec3> image(gui.width * gui.height); 
+	// frames handed from the render thread to the GUI
+	rtt::FrameExchange frames(gui.width * gui.height);
+	rtt::ParameterChannel parameters;
+	parameters.publish(gui); // first accumulation
+	gui.changed = false;
 
 	const auto bvh = rtt::createBVH(dir_path + "/" + scene_name + "/", scene_name);
 
@@ -46,13 +49,14 @@ int main(){
 	// Do ray tracing and display on GUI with threrender(ads
 	vector<thread> threads;
 
-	threads.push_back(thread(rtt::render, std::ref(bvh), std::ref(image), std::ref(gui), std::ref(envmap), std::ref(sampler)));
-	view_gui(image, gui);
+	threads.push_back(thread(rtt::render, std::ref(bvh), std::ref(frames), std::ref(parameters), std::ref(envmap), std::ref(sampler)));
+	view_gui(frames, gui, parameters);
 
 	for(auto& thread : threads){
 		thread.join();
 	}
 	
+	rtt::tracer().finish();
 	cout << "Done!" << endl;
 	return 0;
 }
\ No newline at end of file
@@ -63,8 +63,7 @@ int main() {
 	string dir_path = "scenes";
 	string scene_name = "teapot";	
 
-	vector<vec3> image(640*480); 
-	vector<vec3> buffer(640*480); 
+	rtt::FrameExchange frames(640*480);
 
 	const auto bvh = rtt::createBVH(dir_path + "/" + scene_name + "/", scene_name);
 
@@ -89,7 +88,7 @@ int main() {
 	//int side = 640;
 	//std::vector<std::vector<glm::vec3>> img(side, std::vector<glm::vec3>(side, glm::vec3(0.f))); 
 
-	rtt::renderNextFrame_PPG<true, false>(bvh, std::ref(buffer), std::ref(image) , 640, 480, std::ref(camera), std::ref(envmap), std::pow(2.f, 3), std::ref(sampler), 5, std::ref(material), std::ref(binaryTree), 5);
+	rtt::renderNextFrame_PPG<true, false>(bvh, frames, 640, 480, std::ref(camera), std::ref(envmap), std::pow(2.f, 3), std::ref(sampler), 5, GUI().rouletteDepth, std::ref(material), std::ref(binaryTree), 5);
 
 	/*// Sample only environment map
 	for (int i = 0; i < 1; i ++) { // iteration cycle
@@ -110,5 +109,6 @@ int main() {
 	//saveImage(std::ref(img), side);
 	//img = std::vector<std::vector<glm::vec3>>(side, std::vector<glm::vec3>(side, glm::vec3(0.f)));
 */
+	rtt::tracer().finish();
 	return 0;
 }
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+#include <glm/glm.hpp>
+
+#include "render.h"
+#include "parser.h"
+
+#include "mesh.h"
+#include "envmap.h"
+#include "bvh.h"
+
+#include "materials/material.h"
+
+// Core and scene size scaling. For every size the generator writes a synthetic scene, which is then rendered with
+// every thread count, each run in its own process since the thread pool is sized by OMP_NUM_THREADS at startup.
+// Reports the BVH build time, the peak memory, camera rays per second and the parallel efficiency as CSV.
+//
+// usage:
+//   ./scaling [--kind sphere|soup|grid] [--sizes 10000,100000,1000000] [--threads 1,2,4,8] [--spp 4] [--frames 4] [--csv scaling.csv]
+//   ./scaling --run <scene directory> <scene name> <spp> <frames>   one run, started by the driver
+
+const std::string generatedScenes = "scenes/generated";
+
+std::vector<unsigned long> parseList(const std::string &text) {
+	std::vector<unsigned long> values;
+	std::stringstream ss(text);
+	std::string value;
+	while (std::getline(ss, value, ',')) values.push_back(std::strtoul(value.c_str(), nullptr, 10));
+	return values;
+}
+
+// peak resident memory of the process in MB
+double peakMemory() {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.rfind("VmHWM:", 0) == 0) return std::strtod(line.c_str() + 6, nullptr) / 1024.0;
+	return 0.0;
+}
+
+// prints "result,<triangles>,<build ms>,<peak MB>,<rays/s>"
+int run(const std::string &dir_path, const std::string &scene_name, int spp, unsigned int frames) {
+	GUI settings;
+	settings.cameraOrigin = glm::vec3(0.f, 0.f, -3.f); // the generated scenes fit in the unit sphere
+	settings.mode = 2; // MIS
+
+	EnvMap envmap(dir_path + "/" + scene_name + "/" + scene_name + ".exr", settings.envmapExposure);
+	auto t1 = chrono::high_resolution_clock::now();
+	const auto bvh = rtt::createBVH(dir_path + "/" + scene_name + "/", scene_name);
+	auto t2 = chrono::high_resolution_clock::now();
+
+	Sampler sampler(1u, settings.curr_sampler);
+	rtt::Camera camera(settings.width, settings.height, settings.angleFOV, settings.cameraOrigin, settings.cameraAngle);
+	std::unique_ptr<rtt::Material> material;
+	rtt::getMaterial(settings, material);
+	std::unique_ptr<BinaryTree> binaryTree = std::make_unique<BinaryTree>(bvh->min_, bvh->max_);
+	std::vector<glm::vec3> image(settings.width * settings.height);
+
+	rtt::renderPass(bvh, image, settings, camera, envmap, spp, sampler, material, binaryTree, 0); // warm up
+	auto t3 = chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < frames; i++)
+		rtt::renderPass(bvh, image, settings, camera, envmap, spp, sampler, material, binaryTree, (i + 1) * spp);
+	auto t4 = chrono::high_resolution_clock::now();
+
+	const double rays = settings.width * settings.height * (double) spp * frames / chrono::duration<double>(t4 - t3).count();
+	std::cout << "result," << bvh->triangleCount << "," << chrono::duration<double, std::milli>(t2 - t1).count() << "," << peakMemory() << "," << rays << std::endl;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1 && std::string(argv[1]) == "--run") {
+		if (argc < 6) {
+			std::cout << "usage: " << argv[0] << " --run <scene directory> <scene name> <spp> <frames>" << std::endl;
+			return 1;
+		}
+		return run(argv[2], argv[3], std::atoi(argv[4]), std::atoi(argv[5]));
+	}
+
+	std::string kind = "sphere", csvPath;
+	std::vector<unsigned long> sizes = {10000, 100000, 1000000};
+	std::vector<unsigned long> threadCounts;
+	for (unsigned int n = 1; n < std::thread::hardware_concurrency(); n *= 2) threadCounts.push_back(n);
+	threadCounts.push_back(std::max(1u, std::thread::hardware_concurrency()));
+	int spp = 4;
+	unsigned int frames = 4;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const std::string option = argv[i];
+		if (option == "--kind") kind = argv[i + 1];
+		else if (option == "--sizes") sizes = parseList(argv[i + 1]);
+		else if (option == "--threads") threadCounts = parseList(argv[i + 1]);
+		else if (option == "--spp") spp = std::atoi(argv[i + 1]);
+		else if (option == "--frames") frames = std::atoi(argv[i + 1]);
+		else if (option == "--csv") csvPath = argv[i + 1];
+		else std::cout << "unknown option " << option << std::endl;
+	}
+
+	// the generator sits next to this executable
+	const std::string self = argv[0];
+	const std::string directory = self.find('/') != std::string::npos ? self.substr(0, self.find_last_of('/') + 1) : "./";
+
+	std::ostringstream csv;
+	csv << "kind,triangles,threads,build_ms,peak_memory_mb,rays_per_s,speedup,efficiency\n";
+	for (unsigned long size : sizes) {
+		const std::string name = kind + "_" + std::to_string(size);
+		const std::string generate = directory + "generator " + generatedScenes + " " + name + " " + kind + " " + std::to_string(size) + " > /dev/null";
+		if (std::system(generate.c_str()) != 0) {
+			std::cout << "cannot generate " << name << std::endl;
+			return 1;
+		}
+
+		double baseRays = 0.0;
+		unsigned long baseThreads = 0;
+		for (unsigned long threads : threadCounts) {
+			const std::string command = "OMP_NUM_THREADS=" + std::to_string(threads) + " " + self + " --run " + generatedScenes + " " + name + " " + std::to_string(spp) + " " + std::to_string(frames);
+			FILE *pipe = popen(command.c_str(), "r");
+			if (pipe == nullptr) {
+				std::cout << "cannot run " << command << std::endl;
+				return 1;
+			}
+			std::string result;
+			char line[512];
+			while (std::fgets(line, sizeof(line), pipe) != nullptr)
+				if (std::string(line).rfind("result,", 0) == 0) result = line + 7;
+			if (pclose(pipe) != 0 || result.empty()) {
+				std::cout << "run failed: " << command << std::endl;
+				return 1;
+			}
+
+			unsigned long triangles = 0;
+			double buildMs = 0.0, memory = 0.0, rays = 0.0;
+			std::sscanf(result.c_str(), "%lu,%lf,%lf,%lf", &triangles, &buildMs, &memory, &rays);
+			if (baseThreads == 0) {
+				baseThreads = threads;
+				baseRays = rays;
+			}
+			// relative to the first thread count, normally 1
+			const double speedup = rays / baseRays;
+			const double efficiency = speedup * baseThreads / threads;
+			csv << kind << "," << triangles << "," << threads << "," << buildMs << "," << memory << "," << rays << "," << speedup << "," << efficiency << "\n";
+			std::cout << name << ", " << threads << " threads: build " << buildMs << " ms, " << memory << " MB, " << rays << " rays/s, efficiency " << 100.0 * efficiency << "%" << std::endl;
+		}
+	}
+
+	std::cout << "\n" << csv.str();
+	if (!csvPath.empty()) {
+		std::ofstream file(csvPath);
+		if (!file) {
+			std::cout << "cannot write " << csvPath << std::endl;
+			return 1;
+		}
+		file << csv.str();
+		std::cout << "written to " << csvPath << std::endl;
+	}
+	return 0;
+}